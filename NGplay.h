@@ -0,0 +1,65 @@
+/* ------------------------------------------------------ */
+/* NGplay.h  -  interface for embedding the NGplay engine */
+/*                                                        */
+/* Build the engine without its main() and link it in:    */
+/*   g++ -O2 -c -DNGPLAY_LIBRARY NGplay_9.87b.c           */
+/* All engine state is global: one engine per process.    */
+/* ------------------------------------------------------ */
+
+#ifndef NGPLAY_H
+#define NGPLAY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ng_engine_st NG_ENGINE;
+
+typedef struct {
+  int depth;                 /* last completed iteration */
+  int score;                 /* centipawns for the side to move, mate scores near +-10000 */
+  long long time;            /* milliseconds since the search started */
+  unsigned long long nodes;
+  const char *bestmove;      /* coordinate notation, e.g. e2e4 or e7e8q */
+  const char *pv;            /* principal variation, moves separated by spaces */
+} NG_INFO;
+
+typedef struct {             /* 0 means no limit */
+  int depth;
+  unsigned long long nodes;
+  long long movetime;        /* milliseconds */
+} NG_LIMITS;
+
+typedef void (*NG_INFO_CB)(const NG_INFO *info, void *user);
+
+/* NULL if the hash tables cannot be allocated or an engine exists already */
+NG_ENGINE *NGCreate(void);
+void NGDestroy(NG_ENGINE *engine);
+
+/* fen NULL or "startpos" for the initial position, then moves in coordinate or
+   standard algebraic notation separated by spaces (moves may be NULL).
+   Returns 0 on an illegal position or move, the position is then left as it was. */
+int NGSetPosition(NG_ENGINE *engine, const char *fen, const char *moves);
+
+/* Searches the current position. limits NULL keeps the engine's own time settings,
+   all zero limits search until NGStop(). callback, if given, gets every completed
+   iteration. Returns 0 when the side to move has no move (mate or stalemate). */
+int NGSearch(NG_ENGINE *engine, const NG_LIMITS *limits, NG_INFO_CB callback, void *user);
+
+/* Ends the running search as soon as possible. A stop that comes while no search
+   runs, also just after NGSearch() returned, ends the next search instead.
+   Atomic, so safe from a callback, another thread or a signal handler. */
+void NGStop(NG_ENGINE *engine);
+
+/* Result of the last search, valid until the next NGSearch() */
+const NG_INFO *NGResult(NG_ENGINE *engine);
+
+/* Forget hash tables and history, e.g. before an unrelated position. Hash tables
+   shared with other processes (the -m option) are not cleared, only the history */
+void NGClear(NG_ENGINE *engine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -34,8 +34,102 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
-#include <sys/timeb.h>
 #include <math.h>
+#include "NGplay.h"
+#ifdef _WIN32
+#include <sys/timeb.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* -------------------- PROFILER ------------------------ */
+/* Compile with -DPROFILER to time the hot functions. Each PROFILE_SCOPE(id)
+   adds the ticks spent in its block, minus the time of nested profiled
+   blocks, to ProfTicks[id]. A breakdown is printed after every search.
+   Without PROFILER everything below compiles to nothing. */
+
+#ifdef PROFILER
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROF_CLOCK()      __rdtsc()
+#define PROF_UNIT         "cycles"
+#else
+static unsigned long long ProfNanosecs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((unsigned long long) ts.tv_sec)*1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+#define PROF_CLOCK()      ProfNanosecs()
+#define PROF_UNIT         "ns"
+#endif
+
+enum {PROF_EVAL, PROF_MOVEGEN, PROF_MAKEMOVE, PROF_RETRACT, PROF_HASH, PROF_INCHECK, PROF_SORT, PROF_TT, PROF_N};
+const char *ProfNames[PROF_N] = {"StaticEval", "Move generation", "MakeMove", "RetractLastMove",
+                                 "GetPositionHash", "King in check", "qsort", "TT probe/store"};
+unsigned long long ProfTicks[PROF_N], ProfCalls[PROF_N], ProfStart;
+
+struct ProfScope {
+  int id;
+  unsigned long long t0, nested;
+  ProfScope *parent;
+  static ProfScope *current;
+  ProfScope(int i) : id(i), nested(0), parent(current) { current = this; t0 = PROF_CLOCK(); }
+  ~ProfScope() {
+    unsigned long long t = PROF_CLOCK() - t0;
+    ProfTicks[id] += t - nested;
+    ProfCalls[id]++;
+    if (parent)
+      parent->nested += t;
+    current = parent;
+  }
+};
+ProfScope *ProfScope::current = NULL;
+
+#define PROFILE_SCOPE(id) ProfScope prof_scope_(id)
+
+void ProfReset(void)
+{
+  memset(ProfTicks, 0, sizeof(ProfTicks));
+  memset(ProfCalls, 0, sizeof(ProfCalls));
+  ProfStart = PROF_CLOCK();
+}
+
+void ProfReport(void)
+{
+  int i;
+  unsigned long long total = PROF_CLOCK() - ProfStart, rest = total;
+  fprintf(stderr, "\n%-16s %12s %16s %8s %6s\n", "Function", "Calls", PROF_UNIT, "per call", "%");
+  for (i=0; i<PROF_N; i++) {
+    rest -= (ProfTicks[i] < rest) ? ProfTicks[i] : rest;
+    fprintf(stderr, "%-16s %12llu %16llu %8.1lf %6.2lf\n", ProfNames[i], ProfCalls[i], ProfTicks[i],
+            ProfCalls[i] ? ((double)ProfTicks[i])/ProfCalls[i] : 0.0, total ? 100.0*ProfTicks[i]/total : 0.0);
+  }
+  fprintf(stderr, "%-16s %12s %16llu %8s %6.2lf\n", "Rest of search", "", rest, "", total ? 100.0*rest/total : 0.0);
+}
+
+/* every qsort of the engine is timed through this wrapper */
+void ProfQsort(void *base, size_t n, size_t size, int (*cmp)(const void *, const void *))
+{
+  PROFILE_SCOPE(PROF_SORT);
+  qsort(base, n, size, cmp);
+}
+#define qsort ProfQsort
+
+#else
+#define PROFILE_SCOPE(id)
+#define ProfReset()
+#define ProfReport()
+#endif
 
 /* -------------------- HEADER -------------------------- */
 
@@ -72,8 +166,17 @@
 #define FUTIL_DEPTH       4
 #define MByte             1048576
 #define PV_CHANGE_THRESH  50
+#define ASPIRATION_WINDOW 25
 #define THREAT_THRESH     3
 #define MAX_BOOK_MATCH    9999
+#define LOSING_CAPTURE_V  -127
+#define FOLLOW_SHIFT      6
+#define HISTORY_MAX       8192
+#define MAX_QUIETS        32
+#define MAX_PLY           (2*MAX_DEPTH+8)
+#define MAX_CHECK_SQ      16
+#define ARENA_SIZE        (MAXMV*MAX_PLY)
+#define FOLLOW_MAX        16000
 //#define IS_RANK_7(xy)     (RowNum[xy]==7)
 //#define IS_RANK_2(xy)     (RowNum[xy]==2)
 #define IS_RANK_7(xy)     ((xy)>H6 && (xy)<A8)
@@ -131,11 +234,16 @@ typedef struct piece_st {
 /* ---------- TRANSPOSITION TABLE DEFINITIONS ------------- */
 
 struct tt_st {
-  MOVE hmove;
-  char flag;
-  char depth;
-  short value;
-  unsigned long long PositionHashFull;
+  union {
+    struct {
+      MOVE hmove;
+      char flag;
+      char depth;
+      short value;
+    };
+    unsigned long long data;           /* the fields above as one word */
+  };
+  unsigned long long PositionHashFull; /* stored XOR data: a half written entry fails the key test */
 } *T_T, *Opp_T_T;
 
 struct ptt_st {
@@ -144,6 +252,8 @@ struct ptt_st {
 } *P_T_T;
 
 unsigned int MAX_TT, PMAX_TT;
+char *SharedHashName=NULL;   /* -m<name>: T_T and Opp_T_T live in the POSIX shared memory segment /<name> */
+struct tt_st *SharedTT[2];   /* white to move, black to move */
 
 /* -------------------- GLOBALS ------------------------- */
 
@@ -317,6 +427,14 @@ struct cst {
 
 int cst_p=0;
 
+/* evaluation terms kept up to date move by move, like material */
+struct evinc {
+  int psq;                        /* pawn and knight square tables, white minus black */
+  unsigned char count[PIECEMAX];  /* pieces on the board by type, kings not counted */
+  unsigned char pieces;           /* all of them, the game phase */
+  unsigned char WBishopColor, BBishopColor; /* sums of BishopSquareColor, as in StaticEval */
+};
+
 struct mvst {
   MOVE move;
   PIECE *captured;
@@ -325,6 +443,8 @@ struct mvst {
   unsigned long long PositionHash;
   unsigned long long PawnHash;
   int material;
+  struct evinc ev;
+  int piece;     /* type of the piece moved */
 } move_stack[MAX_STACK];  
 
 int mv_stack_p=0;
@@ -333,12 +453,20 @@ int side=white;
 
 long long int max_time = 180*1000; /* default level 3 minutes / move ---> 40 moves in 2 hours */
 long long int start_time, stop_time;
+/* optional search limits: fixed nodes (0 = none), fixed depth, exact time per move */
+unsigned long long max_nodes = 0;
+int max_depth = MAX_DEPTH, exact_time = 0;
+/* deterministic mode: seeded book choice, node based stopping, nothing kept between searches */
+#define DETERMINISTIC_NPMS 1000 /* nodes per millisecond when max_time is turned into a node budget */
+int Deterministic = 0;
+unsigned long long NodeLimit; /* node limit of the current search, 0 = stop by the clock */
 
 int NotStartingPosition=0;
-unsigned long long g_nodes;
-int Starting_Mv;
+unsigned long long g_nodes, NextTimePoll;
+int Starting_Mv, RootColor=white;
 int ComputerSide = black; 
 int HalfMovesPlayed=0, FiftyMoves=0, Xoutput=0;
+int StartMoveNumber=1, StartColor=white; /* FEN move number and side to move of the position at mv_stack_p 0 */
 
 FILE *book_file=NULL;
 char CurrentLine[2048] = {'\0','\0'};
@@ -350,19 +478,84 @@ int LoneKingReachedEdge=0;
 unsigned long long Rnext = 1;
 
 LINE GlobalPV;
+
+/* the embedding interface (NGplay.h) keeps the last search result here */
+struct ng_engine_st {
+  int created;
+  MOVE best;
+  NG_INFO info;
+  char bestmove[8], pv[6*(MAX_DEPTH+2)+1];
+} TheEngine;
+NG_ENGINE *Engine=NULL;  /* the engine of the console and xboard front ends */
+volatile int StopRequest=0; /* set by NGStop(), cleared when NGSearch() returns, only through __sync builtins */
+NG_INFO_CB InfoCallback=NULL;
+void *InfoUser=NULL;
+
+/* root moves statistics, kept in step with the root move list */
+struct rootst {
+  MOVE move;
+  unsigned long long nodes; /* nodes searched below the move in the last iteration */
+} RootStats[MAXMV];
+
+/* move lists of all plies, each ply's list is written right after its parent's list */
+MOVE MoveArena[ARENA_SIZE];
+#define ARENA_END         (MoveArena + ARENA_SIZE)
+
+/* search stack, one frame per NegaScout level */
+struct search_frame {
+  MOVE CheckAttacks[MAX_CHECK_SQ];    /* checking pieces and squares between them and the king */
+} SearchStack[MAX_PLY+1];
+
+/* triangular PV table: PVTable[level] is the best line found from level on */
+MOVE PVTable[MAX_PLY+1][MAX_PLY+1];
+int PVLength[MAX_PLY+1];
 MOVE PlayerMove;
 
-int TimeIsUp, ngmax=-INFINITY_, PrevNgmax=-INFINITY_, danger;
+int TimeIsUp, ngmax=-INFINITY_, PrevNgmax=-INFINITY_, danger, CompletedDepth;
+/* Fixed node and fixed time limits are hard: a failing PV move (danger) does not extend them */
+#define MUST_STOP_SEARCH  (TimeIsUp && (!danger || NodeLimit || exact_time || StopRequest))
 int NofCores;
 
 #ifdef DBGCUTOFF
 unsigned long long cutoffs_on_1st_move, total_cutoffs;
 #endif
 
+/* Search tree statistics of the current iteration, compile with -DDBGSTATS */
+#ifdef DBGSTATS
+struct stats_st {
+  unsigned long long Nodes, QNodes, PlyNodes[MAX_PLY+1];
+  unsigned long long TTCuts, QTTCuts, RFPrunes, FutilPrunes, NullTries, NullCuts;
+  unsigned long long LmrSearches, LmrResearches, PVResearches, IIDs, CheckExts, Cutoffs, FirstMoveCutoffs;
+} SearchStats;
+unsigned long long StatsPrevNodes;
+#define STATS_INC(field)  (SearchStats.field++)
+#define STATS_PLY()       (SearchStats.PlyNodes[(mv_stack_p - Starting_Mv < MAX_PLY) ? mv_stack_p - Starting_Mv : MAX_PLY]++)
+#else
+#define STATS_INC(field)
+#define STATS_PLY()
+#endif
+
 /* ------------- GLOBAL KILERS/HISTORY TABLES ----------------*/
-int W_history[6][ENDSQ], B_history[6][ENDSQ];
+int W_history[6][ENDSQ], B_history[6][ENDSQ]; /* kept across moves. Range [-HISTORY_MAX, HISTORY_MAX] */
 int W_Killers[2][MAX_DEPTH], B_Killers[2][MAX_DEPTH];
 
+/* ------------- GLOBAL COUNTER MOVE/FOLLOW UP TABLES ----------------*/
+int CounterMoves[PIECEMAX][ENDSQ];                 /* quiet move refuting last move (piece,to), mvv_lva=0 */
+short FollowHistory[2][PIECEMAX][ENDSQ][6][ENDSQ]; /* [0]: reply to opponent last move, [1]: follow up of our previous move */
+short (*FollowContext[2])[ENDSQ];                  /* tables selected by the moves leading to current node */
+int *CounterContext;
+
+/* ------------- CHECK INFO (gives-check detection) ----------------*/
+#define DIR_OFFSET  100
+int Direction[2*DIR_OFFSET]; /* step from a square to another on the same line, indexed by (to - from + DIR_OFFSET). 0 if not aligned */
+
+struct chkinfo {
+  int ksq;             /* square of the king that may be checked */
+  char CheckSq[120];   /* bit 1: diagonal check, 2: straight check, 4: knight check, 8: pawn check */
+  int nDisc;           /* number of pieces that can give discovered check */
+  int DiscSq[8];
+};
+
 /* -------------- UTILITY FUNCTIONS ---------------------------------- */
 
 void Init_Pawn_Eval(void)
@@ -392,9 +585,12 @@ void Init_Pawn_Eval(void)
   }
 }
 
+int HistoryRoot=-1; /* mv_stack_p of the last search root, -1 after a reset */
+
 void ResetHistory(void)
 {
   register int d,i;
+  HistoryRoot = -1;
   for (d=0; d<6; d++) { 
     for (i=A1; i<ENDSQ; i++) {
       W_history[d][i] = 0;
@@ -407,6 +603,113 @@ void ResetHistory(void)
       B_Killers[i][d] = 0;
     }
   }
+  memset(CounterMoves, 0, sizeof(CounterMoves));
+  memset(FollowHistory, 0, sizeof(FollowHistory));
+}
+
+void AgeHistory(int plies)
+{
+  /* Called when the root has moved since the last search. Older results count half,
+     killers move up as many plies as the root advanced */
+  register int d, i, k;
+  for (d=0; d<6; d++) { 
+    for (i=A1; i<ENDSQ; i++) {
+      W_history[d][i] /= 2;
+      B_history[d][i] /= 2;
+    }
+  }
+  for (i=0; i<2 && plies>0; i++) {
+    for (d=0; d<MAX_DEPTH; d++) {
+      W_Killers[i][d] = (d+plies < MAX_DEPTH) ? W_Killers[i][d+plies] : 0;
+      B_Killers[i][d] = (d+plies < MAX_DEPTH) ? B_Killers[i][d+plies] : 0;
+    }
+  }
+  for (k=0; k<2; k++) {
+    short *fp = &FollowHistory[k][0][0][0][0];
+    for (i=0; i<(int)(sizeof(FollowHistory[0])/sizeof(short)); i++) {
+      fp[i] /= 2;
+    }
+  }
+}
+
+void SetSeed(unsigned long long seed)
+{
+  Deterministic = 1;
+  Rnext = seed;
+}
+
+unsigned int NextRandom(void)
+{
+  /* 64 bit linear congruential generator, high bits returned */
+  Rnext = Rnext * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (unsigned int)(Rnext >> 33);
+}
+
+void UpdateHistory(int *hp, int bonus)
+{
+  /* Gravity update: the closer to the limit the smaller the change */
+  *hp += bonus - (*hp) * Abs(bonus) / HISTORY_MAX;
+}
+
+int HistoryValue(int h)
+{
+  /* History mapped into [-MAX_DEPTH+1, -2] band of mvv_lva, 0 if none */
+  if (h <= 0)
+    return 0;
+  return h * (MAX_DEPTH-3) / HISTORY_MAX - MAX_DEPTH + 1;
+}
+
+void SetFollowUpContext(void)
+{
+  /* Select counter move and follow up tables using the last two moves played */
+  register int k, p, to;
+  for (k=0; k<2; k++) {
+    p = mv_stack_p - k;
+    if (p > 0 && move_stack[p].move.u) {
+      to = move_stack[p].move.m.to;
+      FollowContext[k] = FollowHistory[k][move_stack[p].piece][to];
+    } else {
+      FollowContext[k] = NULL;
+    }
+  }
+  if (mv_stack_p > 0 && move_stack[mv_stack_p].move.u) {
+    to = move_stack[mv_stack_p].move.m.to;
+    CounterContext = &CounterMoves[move_stack[mv_stack_p].piece][to];
+  } else {
+    CounterContext = NULL;
+  }
+}
+
+int FollowUpValue(int kind, int xy)
+{
+  /* Follow up history mapped into the history range of mvv_lva, 0 if none */
+  register int sum=0;
+  if (FollowContext[0]) sum += FollowContext[0][kind][xy];
+  if (FollowContext[1]) sum += FollowContext[1][kind][xy];
+  if (sum <= 0)
+    return 0;
+  sum = (sum >> FOLLOW_SHIFT) - MAX_DEPTH + 1;
+  return (sum < -2) ? sum : -2;
+}
+
+void UpdateFollowUp(MOVE *mp, int ptype, int depth)
+{
+  /* A quiet move caused a cut-off. Call SetFollowUpContext() first */
+  register int k, kind, xy=mp->m.to;
+  kind = (ptype > black) ? ptype - BPAWN : ptype - WPAWN;
+  for (k=0; k<2; k++) {
+    if (FollowContext[k]) {
+      FollowContext[k][kind][xy] += depth*depth;
+      if (FollowContext[k][kind][xy] > FOLLOW_MAX)
+        FollowContext[k][kind][xy] = FOLLOW_MAX;
+    }
+  }
+  if (CounterContext) {
+    MOVE cm;
+    cm.u = mp->u;
+    cm.m.mvv_lva = 0;
+    *CounterContext = cm.u;
+  }
 }
 
 void InitPieces(void)
@@ -535,9 +838,15 @@ void InitPieces(void)
 
 long long int GetMillisecs(void)
 {
+#ifdef _WIN32
   struct timeb timebuffer;
   ftime(&timebuffer);
   return (((long long int) timebuffer.time)*1000LL + ((long long int) timebuffer.millitm));
+#else
+  struct timespec ts; /* monotonic: not affected by wall clock adjustments */
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (((long long int) ts.tv_sec)*1000LL + ((long long int) ts.tv_nsec)/1000000LL);
+#endif
 }
 
 int NextSide(int color)
@@ -628,8 +937,44 @@ void InitHash(void)
   }
 }
 
+int PsqTerm(int type, int xy)
+{
+  switch (type) {
+    case WPAWN:   return W_Pawn_E[xy];
+    case BPAWN:   return B_Pawn_E[xy];
+    case WKNIGHT: return KnightE[xy];
+    case BKNIGHT: return -KnightE[xy];
+  }
+  return 0;
+}
+
+void AddEvalPiece(struct evinc *ev, int type, int xy, int sign)
+{
+  /* sign 1 puts a piece of type on xy, -1 takes it away */
+  ev->psq += sign * PsqTerm(type, xy);
+  ev->count[type] += sign;
+  ev->pieces += sign;
+  if (type==WBISHOP) {
+    ev->WBishopColor += sign * BishopSquareColor[WhiteSq[xy]];
+  } else if (type==BBISHOP) {
+    ev->BBishopColor += sign * BishopSquareColor[WhiteSq[xy]];
+  }
+}
+
+void SetEvalTerms(struct evinc *ev)
+{
+  /* from scratch, for the first move after a position is set up */
+  PIECE *p;
+  memset(ev, 0, sizeof(*ev));
+  for (p=Wpieces[0].next; p!=NULL; p=p->next)
+    AddEvalPiece(ev, p->type, p->xy, 1);
+  for (p=Bpieces[0].next; p!=NULL; p=p->next)
+    AddEvalPiece(ev, p->type, p->xy, 1);
+}
+
 unsigned long long GetPositionHash(unsigned long long *pawn_hash)
 {
+  PROFILE_SCOPE(PROF_HASH);
   unsigned long long ret;
   if (mv_stack_p==1) {
     register int i;
@@ -654,6 +999,7 @@ unsigned long long GetPositionHash(unsigned long long *pawn_hash)
       ret ^= hash_ep[boardXY[EnPassantSq]];
     }
     ret ^= (gflags & 319);
+    SetEvalTerms(&move_stack[mv_stack_p].ev);
   } else {
     register int prevmovstp, xy1, xy2, ptype;
     register struct mvst* p;
@@ -668,14 +1014,18 @@ unsigned long long GetPositionHash(unsigned long long *pawn_hash)
     (*pawn_hash) = (move_stack[prevmovstp].PawnHash);
     ptype = board[xy2]->type;
     p->material = move_stack[prevmovstp].material;
+    p->ev = move_stack[prevmovstp].ev;
 
     if (p->special == NORMAL) {
+      p->ev.psq += PsqTerm(ptype, xy2) - PsqTerm(ptype, xy1);
       ret ^= hash_board[ ptype ][xy1];
       if (ptype==WPAWN || ptype==BPAWN) {
         (*pawn_hash) ^= hash_board[ ptype ][xy1];
       }
     } else if (p->special == PROMOT) {
       p->material += SignedMaterialT[ptype];
+      AddEvalPiece(&p->ev, (ptype>black) ? BPAWN : WPAWN, xy1, -1);
+      AddEvalPiece(&p->ev, ptype, xy2, 1);
       if (ptype>black) {
         p->material += PAWN_V;
         ret ^= hash_board[ BPAWN ][xy1];
@@ -708,6 +1058,7 @@ unsigned long long GetPositionHash(unsigned long long *pawn_hash)
     ptype = p->captured->type;
     if (ptype) {
       p->material -= SignedMaterialT[ptype];
+      AddEvalPiece(&p->ev, ptype, p->capt, -1);
       ret ^= hash_board[ ptype ][p->capt]; 
       if (ptype==WPAWN || ptype==BPAWN) {
         (*pawn_hash) ^= hash_board[ ptype ][p->capt];
@@ -756,25 +1107,105 @@ int HashRepetitions(void)
 
 /* ------------------- TRANSPOSITION TABLE ROUTINES ---------------------------------- */
 #define CLUSTER_SIZE 2
+#define QS_DEPTH 0 /* draft of quiescence entries, below any full-width search */
+
+int WhiteKingInCheck(void);
+int BlackKingInCheck(void);
+
+int IsPseudoLegalMove(MOVE *mp, int color)
+{
+  /* Cheap test of a hash move against the board: own piece that can reach the target over
+     a free path. Whether it leaves the king in check is left to the search, except for
+     castling which is only legal out of and through unattacked squares */
+  register int from=mp->m.from, to=mp->m.to, flag=mp->m.flag, dir, sq;
+  int own = (color==white) ? 0 : 10, piece, target, fwd, diff=to-from;
+  if (from < A1 || from > H8 || to < A1 || to > H8)
+    return 0;
+  piece = board[from]->type - own;
+  target = board[to]->type;
+  if (piece < WPAWN || piece > WKING || target < 0 || target == WKING+10-own ||
+      (target > 0 && target-own >= WPAWN && target-own <= WKING)) /* fence, enemy king or own piece */
+    return 0;
+  if (piece==WPAWN) {
+    fwd = (color==white) ? 10 : -10;
+    if ((color==white) ? (to >= A8) : (to <= H1)) {
+      if (flag < WKNIGHT+own || flag > WQUEEN+own)
+        return 0;
+    } else if (flag != WPAWN+own) {
+      return 0;
+    }
+    if (diff==fwd)
+      return (target==0);
+    if (diff==2*fwd)
+      return (target==0 && board[from+fwd]->type==0 && ((color==white) ? IS_RANK_2(from) : IS_RANK_7(from)));
+    if (diff==fwd-1 || diff==fwd+1)
+      return (target > 0 || to==EnPassantSq);
+    return 0;
+  }
+  if (flag != 1)
+    return 0;
+  switch (piece) {
+    case WKNIGHT:
+      return (diff==8 || diff==-8 || diff==12 || diff==-12 || diff==19 || diff==-19 || diff==21 || diff==-21);
+    case WKING:
+      if (diff==1 || diff==-1 || diff==9 || diff==-9 || diff==10 || diff==-10 || diff==11 || diff==-11)
+        return 1;
+      if (from==((color==white) ? E1 : E8) && (diff==2 || diff==-2)) { /* castling, king and rook unmoved */
+        int rook = (diff==2) ? from+3 : from-4;
+        int moved = ((diff==2) ? 1|4 : 1|2) << ((color==white) ? 0 : 3);
+        if ((gflags & moved) || board[rook]->type != WROOK+own)
+          return 0;
+        for (sq=from+diff/2; sq!=rook; sq+=diff/2)
+          if (board[sq]->type)
+            return 0;
+        if ((color==white) ? WhiteKingInCheck() : BlackKingInCheck())
+          return 0;
+        if (color==white) { /* the king may not pass an attacked square, as in the generator */
+          wking = from+diff/2;
+          sq = WhiteKingInCheck();
+          wking = from;
+        } else {
+          bking = from+diff/2;
+          sq = BlackKingInCheck();
+          bking = from;
+        }
+        return !sq;
+      }
+      return 0;
+    default: /* sliders */
+      dir = Direction[diff + DIR_OFFSET];
+      if (dir==0 || (piece==WBISHOP && (dir==1 || dir==-1 || dir==10 || dir==-10)) ||
+          (piece==WROOK && dir!=1 && dir!=-1 && dir!=10 && dir!=-10))
+        return 0;
+      for (sq=from+dir; sq!=to; sq+=dir)
+        if (board[sq]->type)
+          return 0;
+      return 1;
+  }
+}
 
-int Check_TT_PV(struct tt_st *tt, int pdepth, unsigned long long PosHash, int *valueP, MOVE* hmvp)
+int Check_TT_PV(struct tt_st *tt, int pdepth, unsigned long long PosHash, int *valueP, MOVE* hmvp, int color)
 {
+  PROFILE_SCOPE(PROF_TT);
   register unsigned int Indx;
   register int lflag, ldepth, lvalue, i;
   register struct tt_st * ttentry;
 
+  struct tt_st e;
+
   Indx = PosHash & MAX_TT;
   ttentry = &(tt[Indx]);
   for (i=0; i<CLUSTER_SIZE; i++) {
-    if (ttentry->PositionHashFull == PosHash) { //hit
-      ldepth = ttentry->depth;
-      if (ttentry->hmove.u) {
-        *hmvp  = ttentry->hmove;
+    e.data = ttentry->data; /* one copy, checked against the key, then used */
+    if ((ttentry->PositionHashFull ^ e.data) == PosHash) { //hit
+      ldepth = e.depth;
+      if (e.hmove.u && IsPseudoLegalMove(&e.hmove, color)) { /* never hand out a move of a colliding position */
+        *hmvp  = e.hmove;
       }
       if (ldepth >= pdepth) {
-        lflag  = ttentry->flag;
+        lflag  = e.flag;
         if (lflag==EXACT) {
-          lvalue = ttentry->value;
+          lvalue = e.value;
           //////////////////////
           if (lvalue > MATE_CUTOFF) {
             lvalue -= (mv_stack_p - Starting_Mv);
@@ -792,23 +1223,27 @@ int Check_TT_PV(struct tt_st *tt, int pdepth, unsigned long long PosHash, int *v
   return 0;
 }
 
-int Check_TT(struct tt_st *tt, int alpha, int beta, int pdepth, unsigned long long PosHash, int *valueP, MOVE* hmvp)
+int Check_TT(struct tt_st *tt, int alpha, int beta, int pdepth, unsigned long long PosHash, int *valueP, MOVE* hmvp, int color)
 {
+  PROFILE_SCOPE(PROF_TT);
   register unsigned int Indx;
   register int lflag, ldepth, lvalue, i;
   register struct tt_st * ttentry;
 
+  struct tt_st e;
+
   Indx = PosHash & MAX_TT;
   ttentry = &(tt[Indx]);
   for (i=0; i<CLUSTER_SIZE; i++) {
-    if (ttentry->PositionHashFull == PosHash) { //hit
-      ldepth = ttentry->depth;
-      if (ttentry->hmove.u) {
-        *hmvp  = ttentry->hmove;
+    e.data = ttentry->data;
+    if ((ttentry->PositionHashFull ^ e.data) == PosHash) { //hit
+      ldepth = e.depth;
+      if (e.hmove.u && IsPseudoLegalMove(&e.hmove, color)) {
+        *hmvp  = e.hmove;
       }
       if (ldepth >= pdepth) {
-        lflag  = ttentry->flag;
-        lvalue = ttentry->value;
+        lflag  = e.flag;
+        lvalue = e.value;
         //////////////////////
         if (lvalue > MATE_CUTOFF) {
           lvalue -= (mv_stack_p - Starting_Mv);
@@ -842,15 +1277,23 @@ int Check_TT(struct tt_st *tt, int alpha, int beta, int pdepth, unsigned long lo
 
 void Update_TT(struct tt_st *tt, int pdepth, int pvalue, int pflag, unsigned long long PosHash, MOVE hmv)
 {
+  PROFILE_SCOPE(PROF_TT);
   register unsigned int Indx;
   register struct tt_st *tupd;
+  struct tt_st e;
   Indx = PosHash & MAX_TT;
   tupd = &(tt[Indx]);
   if (pdepth < (int)tupd->depth) {
     tupd++;
   }
-  tupd->flag  = (char)pflag;
-  tupd->depth = (char)pdepth;
+  e.data = tupd->data; /* built aside and written as two words */
+  if (hmv.u) {
+    e.hmove = hmv;
+  } else if ((tupd->PositionHashFull ^ e.data) != PosHash) { /* do not inherit the move of another position */
+    e.hmove.u = 0;
+  }
+  e.flag  = (char)pflag;
+  e.depth = (char)pdepth;
   /////////////////////////////////////
   if (pvalue > MATE_CUTOFF) {
     pvalue += (mv_stack_p - Starting_Mv);
@@ -858,19 +1301,30 @@ void Update_TT(struct tt_st *tt, int pdepth, int pvalue, int pflag, unsigned lon
     pvalue -= (mv_stack_p - Starting_Mv);
   }
   //////////////////////////////////////
-  tupd->value = (short)pvalue;
-  tupd->PositionHashFull = PosHash;
-  if (hmv.u) {
-    tupd->hmove = hmv;
-  }
+  e.value = (short)pvalue;
+  tupd->data = e.data;
+  tupd->PositionHashFull = PosHash ^ e.data;
+}
+
+void ClearHashTables(void)
+{
+  /* A shared table is left alone: other processes are using it. -s, bench and epd,
+     which rely on empty tables, are therefore refused with -m */
+  if (SharedHashName)
+    return;
+  memset(T_T, 0, (MAX_TT+CLUSTER_SIZE)*sizeof(struct tt_st));
+  memset(Opp_T_T, 0, (MAX_TT+CLUSTER_SIZE)*sizeof(struct tt_st));
 }
 
 /* ----------- SEARCH UTILITY FUNCTIONS ----------------------------- */
 
+#define TIME_POLL_NODES 4096 /* nodes searched between two reads of the clock */
+
 void InitTime(void)
 {
   start_time = GetMillisecs();
   stop_time = start_time + max_time;
+  NextTimePoll = TIME_POLL_NODES;
 }
 
 int CheckTime(void)
@@ -881,6 +1335,22 @@ int CheckTime(void)
   return 0;
 }
 
+/* Cheap test for the search loop: the clock is read only every TIME_POLL_NODES nodes */
+int PollTime(void)
+{
+  if (g_nodes < NextTimePoll) {
+    return (NodeLimit && g_nodes >= NodeLimit);
+  }
+  NextTimePoll = g_nodes + TIME_POLL_NODES;
+  if (StopRequest) {
+    return 1;
+  }
+  if (NodeLimit) { /* node limited search ignores the clock so that results are reproducible */
+    return (g_nodes >= NodeLimit);
+  }
+  return CheckTime();
+}
+
 int HaveNeighborColummns(int xy1, int xy2)
 {
   register int ab = ColNum[xy1] - ColNum[xy2];
@@ -970,6 +1440,7 @@ void TryMove(MOVE *mp) /* No ep/castle flags checked */
   register int flag=mp->m.flag;
   mv_stack_p++;
   move_stack[mv_stack_p].move.u = mp->u;
+  move_stack[mv_stack_p].piece = board[xy1]->type;
   move_stack[mv_stack_p].special = NORMAL;
   if (board[xy1]->type==WPAWN) {
     xydif = xy2-xy1;
@@ -1046,6 +1517,7 @@ void TryMove(MOVE *mp) /* No ep/castle flags checked */
 
 void MakeMove(MOVE *mp)
 {
+  PROFILE_SCOPE(PROF_MAKEMOVE);
   register int xy1, xy2, flag, ptype1, xyc, xydif;
   xy1  = mp->m.from;
   xy2  = mp->m.to;
@@ -1053,6 +1525,7 @@ void MakeMove(MOVE *mp)
   ptype1 = board[xy1]->type;
   mv_stack_p++;
   move_stack[mv_stack_p].move.u = mp->u;
+  move_stack[mv_stack_p].piece = ptype1;
   EnPassantSq=0;
   move_stack[mv_stack_p].special = NORMAL;
   if (ptype1==WPAWN) {
@@ -1183,6 +1656,7 @@ void MakeMove(MOVE *mp)
 
 void RetractLastMove(void)
 {
+  PROFILE_SCOPE(PROF_RETRACT);
   register int xy1=move_stack[mv_stack_p].move.m.from;
   register int xy2=move_stack[mv_stack_p].move.m.to;
   register int cpt=move_stack[mv_stack_p].capt;
@@ -2023,6 +2497,7 @@ int WhiteKingInCheckInfo(MOVE AttackSq[], int *Attackers)
 
 int WhiteKingInCheck(void)
 {
+  PROFILE_SCOPE(PROF_INCHECK);
   register int xyk=wking, xy;
   register int test;
   /* black pawn checks & kings side by side and some knights square */
@@ -2208,24 +2683,28 @@ void AddWhiteMv(int xy0, int xy, int flag, MOVE q[], int *nextf, int MvvLva, int
   mp.m.to      = xy;
   mp.m.flag    = flag;
   if (MvvLva==0) {
-    if (level>=0) {
-      if ( W_Killers[0][level] == mp.u ) {
-        mp.m.mvv_lva = 1;
-      } else if ( W_Killers[1][level] == mp.u ) {
-        mp.m.mvv_lva = 0;
-      } else {
-        W_history_hit = W_history[ board[xy0]->type - WPAWN ][xy];
-      } 
-    } else {
-      W_history_hit = W_history[ board[xy0]->type - WPAWN ][xy];
-    }
-    if (W_history_hit != 0) {
-      mp.m.mvv_lva = W_history_hit;
+    mp.m.mvv_lva = 0; /* killers and counter moves are stored with zero priority */
+    if (level>=0 && W_Killers[0][level] == mp.u) {
+      mp.m.mvv_lva = 1;
+    } else if (level>=0 && W_Killers[1][level] == mp.u) {
+      mp.m.mvv_lva = 0;
+    } else if (level>=0 && CounterContext && *CounterContext == mp.u) {
+      mp.m.mvv_lva = -1;
     } else {
-      if (xy>bking) {
-        mp.m.mvv_lva = bking-xy-MAX_DEPTH;
+      W_history_hit = HistoryValue(W_history[ board[xy0]->type - WPAWN ][xy]);
+      if (level>=0) {
+        register int f = FollowUpValue(board[xy0]->type - WPAWN, xy);
+        if (f != 0 && (W_history_hit == 0 || f > W_history_hit))
+          W_history_hit = f;
+      }
+      if (W_history_hit != 0) {
+        mp.m.mvv_lva = W_history_hit;
       } else {
-        mp.m.mvv_lva = xy-bking-MAX_DEPTH;
+        if (xy>bking) {
+          mp.m.mvv_lva = bking-xy-MAX_DEPTH;
+        } else {
+          mp.m.mvv_lva = xy-bking-MAX_DEPTH;
+        }
       }
     }
   } else {
@@ -3103,8 +3582,18 @@ int MOVE_cmp_by_mvv_lva(const void *a, const void *b)
     return (int)ib->m.mvv_lva - (int)ia->m.mvv_lva;
 } 
 
+int ROOT_cmp_by_nodes(const void *a, const void *b) 
+{ 
+    struct rootst *ia = (struct rootst *)a;
+    struct rootst *ib = (struct rootst *)b;
+    if (ib->nodes > ia->nodes) return 1;
+    if (ib->nodes < ia->nodes) return -1;
+    return 0;
+} 
+
 int FindAllWhiteEvasions(MOVE q[], MOVE qAttacks[], int nA, int nAPieces)
 {
+  PROFILE_SCOPE(PROF_MOVEGEN);
   register int test, j;
   int nextfree=0;
   AddWhiteKingMoves(Wpieces[0].xy,q,&nextfree);
@@ -3155,6 +3644,7 @@ int FindAllWhiteEvasions(MOVE q[], MOVE qAttacks[], int nA, int nAPieces)
 
 int FindAllWhiteMoves(MOVE q[], int level=-1)
 {
+  PROFILE_SCOPE(PROF_MOVEGEN);
   int nextfree=0;
   /* Find Moves plus mobility value for Rooks,Queens,Bishops,Knights. */
   /* Also subtract mobility normalization value */
@@ -3186,6 +3676,7 @@ int FindAllWhiteMoves(MOVE q[], int level=-1)
 
 int FindAllWhiteCapturesAndPromotions(MOVE q[]) /* This is used in quiescence search */
 {
+  PROFILE_SCOPE(PROF_MOVEGEN);
   int nextfree=0;
   /* Find Moves plus mobility value for Rooks,Queens,Bishops,Knights. */
   /* Also subtract mobility normalization value */
@@ -3623,6 +4114,7 @@ int BlackKingInCheckInfo(MOVE AttackSq[], int *Attackers)
 
 int BlackKingInCheck(void)
 {
+  PROFILE_SCOPE(PROF_INCHECK);
   register int xy=bking, xyk;
   register int test;
   /* white pawn checks &  kings side by side & some knight squares*/
@@ -3800,24 +4292,28 @@ void AddBlackMv(int xy0, int xy, int flag, MOVE q[], int *nextf, int MvvLva, int
   mp.m.to      = xy;
   mp.m.flag    = flag;
   if (MvvLva==0) {
-    if (level>=0) {
-      if ( B_Killers[0][level] == mp.u ) {
-        mp.m.mvv_lva = 1;
-      } else if ( B_Killers[1][level] == mp.u ) {
-        mp.m.mvv_lva = 0;
-      } else {
-        B_history_hit = B_history[ board[xy0]->type - BPAWN ][xy];
-      } 
+    mp.m.mvv_lva = 0; /* killers and counter moves are stored with zero priority */
+    if (level>=0 && B_Killers[0][level] == mp.u) {
+      mp.m.mvv_lva = 1;
+    } else if (level>=0 && B_Killers[1][level] == mp.u) {
+      mp.m.mvv_lva = 0;
+    } else if (level>=0 && CounterContext && *CounterContext == mp.u) {
+      mp.m.mvv_lva = -1;
     } else {
-      B_history_hit = B_history[ board[xy0]->type - BPAWN ][xy];
-    }
-    if (B_history_hit != 0) {
-      mp.m.mvv_lva = B_history_hit;
-    } else {
-      if (xy>wking) {
-        mp.m.mvv_lva = wking-xy-MAX_DEPTH;
+      B_history_hit = HistoryValue(B_history[ board[xy0]->type - BPAWN ][xy]);
+      if (level>=0) {
+        register int f = FollowUpValue(board[xy0]->type - BPAWN, xy);
+        if (f != 0 && (B_history_hit == 0 || f > B_history_hit))
+          B_history_hit = f;
+      }
+      if (B_history_hit != 0) {
+        mp.m.mvv_lva = B_history_hit;
       } else {
-        mp.m.mvv_lva = xy-wking-MAX_DEPTH;
+        if (xy>wking) {
+          mp.m.mvv_lva = wking-xy-MAX_DEPTH;
+        } else {
+          mp.m.mvv_lva = xy-wking-MAX_DEPTH;
+        }
       }
     }
   } else {
@@ -4694,6 +5190,7 @@ void AddBlackKingCaptures(int xy0, MOVE q[], int *nextf)
 
 int FindAllBlackEvasions(MOVE q[], MOVE qAttacks[], int nA, int nAPieces)
 {
+  PROFILE_SCOPE(PROF_MOVEGEN);
   register int test, j;
   int nextfree=0;
   AddBlackKingMoves(Bpieces[0].xy,q,&nextfree);
@@ -4744,6 +5241,7 @@ int FindAllBlackEvasions(MOVE q[], MOVE qAttacks[], int nA, int nAPieces)
 
 int FindAllBlackMoves(MOVE q[], int level=-1)
 {
+  PROFILE_SCOPE(PROF_MOVEGEN);
   int nextfree=0;
   /* Find Moves plus mobility value for Rooks,Queens,Bishops,Knights. */
   /* Also subtract mobility normalization value */
@@ -4775,6 +5273,7 @@ int FindAllBlackMoves(MOVE q[], int level=-1)
 
 int FindAllBlackCapturesAndPromotions(MOVE q[])
 {
+  PROFILE_SCOPE(PROF_MOVEGEN);
   int nextfree=0;
   /* Find Moves plus mobility value for Rooks,Queens,Bishops,Knights. */
   /* Also subtract mobility normalization value */
@@ -5092,6 +5591,7 @@ int EvalPatterns(void)
   
 int StaticEval(int * EnoughMaterial)
 {
+  PROFILE_SCOPE(PROF_EVAL);
   register int i, j, xy, ret=0, WhitePieces=0, BlackPieces=0, xy0, Passed, isolated;
   register int queens=0, rooks=0, Wbishops=0, Wknights=0, Bbishops=0, Bknights=0, wpawns=0, bpawns=0, allpawns=0;
   register int WBishopColor=0, BBishopColor=0; /*0: No bishop, 1:LightSq, 2:DarkSq, 3:Both */
@@ -5100,64 +5600,33 @@ int StaticEval(int * EnoughMaterial)
   int Wisolani=0, Bisolani=0;
   register unsigned int Indx;
   int pawnHashHit=0, extra_pawn_val=0;
+  struct evinc *ev = &move_stack[mv_stack_p].ev;
 
   *EnoughMaterial = -1;
-  ret = move_stack[mv_stack_p].material;
-
+  if (mv_stack_p==0) /* position set up, no move made yet */
+    SetEvalTerms(ev);
+  ret = move_stack[mv_stack_p].material + ev->psq;
+  /* mobility is left in the pieces by the move generator, the rest is kept by MakeMove */
   for (PIECE *p=Wpieces[0].next; p!=NULL; p=p->next) {
-    WhitePieces++;
-    switch (p->type) {
-       case WPAWN  : 
-         wpawns++;
-         ret += W_Pawn_E[p->xy];
-         break;
-       case WROOK  : 
-         ret += p->mobility;
-         rooks++;
-         break;
-       case WKNIGHT: 
-         ret += p->mobility;
-         ret += KnightE[p->xy];
-         Wknights++;
-         break;
-       case WBISHOP: 
-         ret += p->mobility;
-         Wbishops++;
-         WBishopColor += BishopSquareColor[WhiteSq[p->xy]];
-         break;
-       case WQUEEN : 
-         ret += p->mobility;
-         queens++;
-         break;
-    }
+    if (p->type != WPAWN)
+      ret += p->mobility;
   }
   for (PIECE *p=Bpieces[0].next; p!=NULL; p=p->next) {
-    BlackPieces++;
-    switch (p->type) { 
-       case BPAWN  : 
-         bpawns++;
-         ret += B_Pawn_E[p->xy];
-         break;
-       case BROOK  : 
-         ret -= p->mobility; 
-         rooks++;
-         break;
-       case BKNIGHT: 
-         ret -= p->mobility; 
-         ret -= KnightE[p->xy];
-         Bknights++;
-         break;
-       case BBISHOP: 
-         ret -= p->mobility;
-         Bbishops++;
-         BBishopColor += BishopSquareColor[WhiteSq[p->xy]];
-         break;
-       case BQUEEN : 
-         ret -= p->mobility;
-         queens++;
-        break;
-    }
-  }
+    if (p->type != BPAWN)
+      ret -= p->mobility;
+  }
+  wpawns = ev->count[WPAWN];
+  bpawns = ev->count[BPAWN];
+  Wknights = ev->count[WKNIGHT];
+  Bknights = ev->count[BKNIGHT];
+  Wbishops = ev->count[WBISHOP];
+  Bbishops = ev->count[BBISHOP];
+  rooks = ev->count[WROOK] + ev->count[BROOK];
+  queens = ev->count[WQUEEN] + ev->count[BQUEEN];
+  WBishopColor = ev->WBishopColor;
+  BBishopColor = ev->BBishopColor;
+  WhitePieces = wpawns + Wknights + Wbishops + ev->count[WROOK] + ev->count[WQUEEN];
+  BlackPieces = ev->pieces - WhitePieces;
   allpawns = wpawns+bpawns;
   /* Depending on number of pawns, add bonus for 2 bishops .. small bonus for 2 knights*/
   if (allpawns<15) {
@@ -5712,6 +6181,8 @@ int IsBookLine(int *BookLineNoP, MOVE movelst[], int moves, int color)
   }
   if (matched==1) {
     *BookLineNoP = MatchingBookMoves[0];
+  } else if (Deterministic) {
+    *BookLineNoP = MatchingBookMoves[NextRandom() % matched];
   } else {
     int r=rand();
     int Secs=GetMillisecs()/1000;
@@ -5751,6 +6222,7 @@ void StartingPosition(void)
   board[D8]=&Bpieces[1]; Bpieces[1].xy=D8; /* BQUEEN */
   board[E1]=&Wpieces[0]; Wpieces[0].xy=E1; /* WKING */
   board[E8]=&Bpieces[0]; Bpieces[0].xy=E8; /* BKING */
+  wking=E1; bking=E8; /* a FEN set up before may have moved them */
   for (i=0; i<8; i++) {
     board[i+A2]= &Wpieces[i+8]; Wpieces[i+8].xy=i+A2; /* WPAWNS */
     board[i+A7]= &Bpieces[i+8]; Bpieces[i+8].xy=i+A7; /* BPAWNS */
@@ -5765,6 +6237,8 @@ void StartingPosition(void)
   CurrentLine[0] = '\0';
   LoneKingReachedEdge=0;
   FiftyMoves=0;
+  StartMoveNumber=1;
+  StartColor=white;
   NotStartingPosition = 0;
   PlayerMove.u=0;
 }
@@ -5820,12 +6294,228 @@ void OutputDanger(int depth, int score, MOVE *defenseP)
   }
 }
 
-int Quiescence(int alpha, int beta, int color)
+void InitDirections(void)
+{
+  int i, j, xy, sq;
+  int dirs[8] = {1, -1, 10, -10, 9, -9, 11, -11};
+  for (i=0; i<2*DIR_OFFSET; i++) {
+    Direction[i] = 0;
+  }
+  for (i=0; i<64; i++) {
+    xy = board64[i];
+    for (j=0; j<8; j++) {
+      for (sq=xy+dirs[j]; (sq%10)>=1 && (sq%10)<=8 && sq>=A1 && sq<=H8; sq+=dirs[j]) {
+        Direction[sq - xy + DIR_OFFSET] = dirs[j];
+      }
+    }
+  }
+}
+
+void InitCheckInfo(struct chkinfo *ci, int color)
+{
+  /* Collects the squares from which a piece of color would check the enemy king
+     and the pieces of color that would uncover a check by moving away */
+  register int i, sq, test, dir, ray;
+  int dirs[8] = {9, -9, 11, -11, 1, -1, 10, -10};
+  int knights[8] = {8, -8, 12, -12, 19, -19, 21, -21};
+  int ksq = (color==white) ? bking : wking;
+  ci->ksq = ksq;
+  ci->nDisc = 0;
+  memset(ci->CheckSq, 0, sizeof(ci->CheckSq));
+  for (i=0; i<8; i++) {
+    sq = ksq + knights[i];
+    if (sq>=0 && sq<120) ci->CheckSq[sq] |= 4;
+  }
+  if (color==white) {
+    ci->CheckSq[ksq-9]  |= 8;
+    ci->CheckSq[ksq-11] |= 8;
+  } else {
+    ci->CheckSq[ksq+9]  |= 8;
+    ci->CheckSq[ksq+11] |= 8;
+  }
+  for (i=0; i<8; i++) {
+    dir = dirs[i];
+    ray = (i<4) ? 1 : 2;
+    for (sq=ksq+dir; board[sq]->type==0; sq+=dir) {
+      ci->CheckSq[sq] |= ray;
+    }
+    test = board[sq]->type;
+    if (test == -1) continue;
+    if ((color==white) ? (test > black) : (test < black)) {
+      ci->CheckSq[sq] |= ray; /* checking by capture */
+    } else {
+      /* own piece: is there a slider of ours behind it? */
+      int blocker = sq;
+      for (sq+=dir; board[sq]->type==0; sq+=dir)
+        ;
+      test = board[sq]->type;
+      if ((color==white) ? (test > 0 && test < black) : (test > black)) {
+        if (test > black) test -= (BPAWN-WPAWN);
+        if (test==WQUEEN || (ray==1 && test==WBISHOP) || (ray==2 && test==WROOK)) {
+          ci->DiscSq[ci->nDisc++] = blocker;
+        }
+      }
+    }
+  }
+}
+
+int MoveGivesCheck(MOVE *mp, struct chkinfo *ci)
+{
+  /* Returns 0 if the move surely does not give check, 1 if it may give check */
+  register int i, from=mp->m.from, to=mp->m.to, ptype;
+  if (mp->m.flag!=1 && mp->m.flag!=WPAWN && mp->m.flag!=BPAWN) return 1; /* promotion */
+  ptype = board[from]->type;
+  if (ptype > black) ptype -= (BPAWN-WPAWN);
+  switch (ptype) {
+    case WPAWN:
+      if (ci->CheckSq[to] & 8) return 1;
+      if (to==EnPassantSq) return 1;
+      break;
+    case WKNIGHT:
+      if (ci->CheckSq[to] & 4) return 1;
+      break;
+    case WBISHOP:
+      if (ci->CheckSq[to] & 1) return 1;
+      break;
+    case WROOK:
+      if (ci->CheckSq[to] & 2) return 1;
+      break;
+    case WQUEEN:
+      if (ci->CheckSq[to] & 3) return 1;
+      break;
+    case WKING:
+      if (Abs(to-from)==2) return 1; /* castling */
+      break;
+  }
+  for (i=0; i<ci->nDisc; i++) {
+    if (ci->DiscSq[i]==from) {
+      if (Direction[ci->ksq - to + DIR_OFFSET] != Direction[ci->ksq - from + DIR_OFFSET]) return 1;
+      break;
+    }
+  }
+  return 0;
+}
+
+int LeastValuableAttacker(int xy, int color)
+{
+  /* Returns the square of the cheapest piece of color attacking xy, or 0 */
+  register int sq, test, off, queen_sq=0;
+  if (color==white) {
+    off = 0;
+    if (board[xy-9]->type==WPAWN)  return xy-9;
+    if (board[xy-11]->type==WPAWN) return xy-11;
+  } else {
+    off = BPAWN-WPAWN;
+    if (board[xy+9]->type==BPAWN)  return xy+9;
+    if (board[xy+11]->type==BPAWN) return xy+11;
+  }
+  if (board[xy+8]->type==WKNIGHT+off)  return xy+8;
+  if (board[xy-8]->type==WKNIGHT+off)  return xy-8;
+  if (board[xy+12]->type==WKNIGHT+off) return xy+12;
+  if (board[xy-12]->type==WKNIGHT+off) return xy-12;
+  if (board[xy+19]->type==WKNIGHT+off) return xy+19;
+  if (board[xy-19]->type==WKNIGHT+off) return xy-19;
+  if (board[xy+21]->type==WKNIGHT+off) return xy+21;
+  if (board[xy-21]->type==WKNIGHT+off) return xy-21;
+  /* bishop or queen on diagonals */
+  sq=xy; do { sq+=9;  } while (board[sq]->type==0);
+  test = board[sq]->type;
+  if (test==WBISHOP+off) return sq; else if (test==WQUEEN+off) queen_sq=sq;
+  sq=xy; do { sq-=9;  } while (board[sq]->type==0);
+  test = board[sq]->type;
+  if (test==WBISHOP+off) return sq; else if (test==WQUEEN+off) queen_sq=sq;
+  sq=xy; do { sq+=11; } while (board[sq]->type==0);
+  test = board[sq]->type;
+  if (test==WBISHOP+off) return sq; else if (test==WQUEEN+off) queen_sq=sq;
+  sq=xy; do { sq-=11; } while (board[sq]->type==0);
+  test = board[sq]->type;
+  if (test==WBISHOP+off) return sq; else if (test==WQUEEN+off) queen_sq=sq;
+  /* rook or queen on files and ranks */
+  sq=xy; do { sq++;   } while (board[sq]->type==0);
+  test = board[sq]->type;
+  if (test==WROOK+off) return sq; else if (test==WQUEEN+off) queen_sq=sq;
+  sq=xy; do { sq--;   } while (board[sq]->type==0);
+  test = board[sq]->type;
+  if (test==WROOK+off) return sq; else if (test==WQUEEN+off) queen_sq=sq;
+  sq=xy; do { sq+=10; } while (board[sq]->type==0);
+  test = board[sq]->type;
+  if (test==WROOK+off) return sq; else if (test==WQUEEN+off) queen_sq=sq;
+  sq=xy; do { sq-=10; } while (board[sq]->type==0);
+  test = board[sq]->type;
+  if (test==WROOK+off) return sq; else if (test==WQUEEN+off) queen_sq=sq;
+  if (queen_sq)
+    return queen_sq;
+  /* king last */
+  if (board[xy+1]->type==WKING+off)  return xy+1;
+  if (board[xy-1]->type==WKING+off)  return xy-1;
+  if (board[xy+9]->type==WKING+off)  return xy+9;
+  if (board[xy-9]->type==WKING+off)  return xy-9;
+  if (board[xy+10]->type==WKING+off) return xy+10;
+  if (board[xy-10]->type==WKING+off) return xy-10;
+  if (board[xy+11]->type==WKING+off) return xy+11;
+  if (board[xy-11]->type==WKING+off) return xy-11;
+  return 0;
+}
+
+int StaticExchangeEval(int from, int to)
+{
+  /* Static Exchange Evaluation of the capture from->to using the swap list algorithm.      */
+  /* Attackers are taken off the board one by one, so x-ray attackers behind them join in. */
+  register int d=0, sq, color, OnSquareV;
+  int gain[32], nremoved=0, removed_xy[32];
+  PIECE *removed_p[32];
+
+  gain[0] = PieceValFromType[board[to]->type];
+  if (gain[0]==0) /* en passant */
+    gain[0] = PAWN_V;
+  OnSquareV = PieceValFromType[board[from]->type];
+  color = (board[from]->type > black) ? white : black; /* side to recapture */
+  removed_xy[nremoved] = from;
+  removed_p[nremoved++] = board[from];
+  board[from] = &empty_p;
+  while ((sq = LeastValuableAttacker(to, color)) != 0) {
+    d++;
+    gain[d] = OnSquareV - gain[d-1];
+    if (gain[d] <= -gain[d-1]) /* standing pat is already as good, further captures cannot change it */
+      break;
+    OnSquareV = PieceValFromType[board[sq]->type];
+    removed_xy[nremoved] = sq;
+    removed_p[nremoved++] = board[sq];
+    board[sq] = &empty_p;
+    color = NextSide(color);
+  }
+  while (d) {
+    if (gain[d] > -gain[d-1])
+      gain[d-1] = -gain[d];
+    d--;
+  }
+  while (nremoved) {
+    nremoved--;
+    board[removed_xy[nremoved]] = removed_p[nremoved];
+  }
+  return gain[0];
+}
+
+int IsLosingCapture(MOVE *mp)
+{
+  /* Promotions and captures of a piece at least as valuable as the attacker cannot lose material */
+  register int flag = mp->m.flag, from = mp->m.from, to = mp->m.to;
+  if (flag!=1)
+    return 0;
+  if (PieceValFromType[board[to]->type] >= PieceValFromType[board[from]->type])
+    return 0;
+  return (StaticExchangeEval(from, to) < 0);
+}
+
+int Quiescence(int alpha, int beta, int color, MOVE movelst[])
 {
   register int e, score, i, m, NextColor, delta_1;
-  int IsMaterialEnough;
-  MOVE movelst[MAXMV];
+  int IsMaterialEnough, TT_value, OrigAlpha=alpha;
+  struct tt_st *tt = (color==RootColor) ? T_T : Opp_T_T; /* same split as the level parity in NegaScout */
+  MOVE HashBest, QBest;
   g_nodes++;
+  HashBest.u = QBest.u = 0;
+  STATS_INC(QNodes); STATS_PLY();
   if (color==black) {
     e = -StaticEval(&IsMaterialEnough);
     if (IsMaterialEnough==0)
@@ -5833,7 +6523,7 @@ int Quiescence(int alpha, int beta, int color)
     e += (mv_stack_p - Starting_Mv);
     if( e >= beta )
       return beta;
-    if (mv_stack_p - Starting_Mv > MAX_DEPTH ) {
+    if (mv_stack_p - Starting_Mv > MAX_DEPTH || movelst + MAXMV > ARENA_END) {
       return e;
     }
     delta_1 = QUEEN_V + PAWN_V;
@@ -5856,7 +6546,7 @@ int Quiescence(int alpha, int beta, int color)
     e -= (mv_stack_p - Starting_Mv);
     if( e >= beta )
       return beta;
-    if (mv_stack_p - Starting_Mv > MAX_DEPTH ) {
+    if (mv_stack_p - Starting_Mv > MAX_DEPTH || movelst + MAXMV > ARENA_END) {
       return e;
     }
     delta_1 = QUEEN_V + PAWN_V;
@@ -5873,10 +6563,21 @@ int Quiescence(int alpha, int beta, int color)
       return e;
     NextColor = black;
   }
+  /* Probe only nodes that have captures to search: stand pat cutoffs are cheaper than a table access */
+  if (Check_TT(tt, alpha, beta, QS_DEPTH, move_stack[mv_stack_p].PositionHash, &TT_value, &HashBest, color)) {
+    STATS_INC(QTTCuts);
+    return TT_value;
+  }
+  if (HashBest.u) {
+    FindAndUpdateInPlace(movelst, m, HashBest, 0);
+  }
   for (i=0; i<m; i++) {
     if ( (e + PieceValFromType[board[movelst[i].m.to]->type] + DELTAMARGIN) < alpha ) {
       continue;
     }
+    if ( IsLosingCapture(&movelst[i]) ) { /* SEE pruning */
+      continue;
+    }
     PushStatus();
     MakeMove(&movelst[i]);
     if (color==black) {
@@ -5884,29 +6585,31 @@ int Quiescence(int alpha, int beta, int color)
     } else {
       if (WhiteKingInCheck()) { RetractLastMove(); PopStatus(); continue; }
     }
-    score =  - Quiescence(-beta, -alpha, NextColor);
+    score =  - Quiescence(-beta, -alpha, NextColor, movelst + m);
     RetractLastMove(); PopStatus();
     if( score >= beta ) {
+      Update_TT(tt, QS_DEPTH, beta, CHECK_BETA, move_stack[mv_stack_p].PositionHash, movelst[i]);
       return beta;
     }
     if( score > alpha ) {
       alpha = score;
+      QBest = movelst[i];
     }
   }
+  Update_TT(tt, QS_DEPTH, alpha, (alpha > OrigAlpha) ? EXACT : CHECK_ALPHA, move_stack[mv_stack_p].PositionHash, QBest);
   return alpha;
 }
 
-int Negalight(int depth, int alpha, int beta, int color)
+int Negalight(int depth, int alpha, int beta, int color, MOVE m2lst[])
 {
-  if (depth==0) 
+  if (depth==0 || m2lst + MAXMV > ARENA_END) 
   { /* terminal node  */
-    return Quiescence(alpha, beta, color);
+    return Quiescence(alpha, beta, color, m2lst);
   } 
   else 
   {
     register int i;
     int x, n2=-1, NextColor, actual=0;
-    MOVE m2lst[MAXMV];
     if (color==white) {
       n2 = FindAllWhiteMoves(m2lst);
       qsort(m2lst, n2, sizeof(MOVE), MOVE_cmp_by_mvv_lva);
@@ -5924,7 +6627,7 @@ int Negalight(int depth, int alpha, int beta, int color)
       } else {
         if (WhiteKingInCheck()) { RetractLastMove(); PopStatus(); continue; }
       }
-      x =  - Negalight(depth-1, -beta, -alpha, NextColor);
+      x =  - Negalight(depth-1, -beta, -alpha, NextColor, m2lst + n2);
       RetractLastMove(); PopStatus();
       if (x>alpha) {
         alpha = x;
@@ -5973,61 +6676,122 @@ int ReverseFutilityPruning(int depth, int eval, int beta)
   return 0;
 }
 
+int IsLegalHashMove(MOVE *mp, int color, MOVE scratch[])
+{
+  /* Hash moves may come from a key collision. Accept only a legal move of this position */
+  register int i, n, legal=0;
+  n = (color==white) ? FindAllWhiteMoves(scratch) : FindAllBlackMoves(scratch);
+  for (i=0; i<n; i++) {
+    if (scratch[i].m.from==mp->m.from && scratch[i].m.to==mp->m.to && scratch[i].m.flag==mp->m.flag) {
+      PushStatus();
+      MakeMove(&scratch[i]);
+      legal = (color==white) ? !WhiteKingInCheck() : !BlackKingInCheck();
+      RetractLastMove(); PopStatus();
+      break;
+    }
+  }
+  return legal;
+}
+
+MOVE ProbeHashMove(struct tt_st *tt, unsigned long long PosHash)
+{
+  PROFILE_SCOPE(PROF_TT);
+  register int i;
+  register struct tt_st * ttentry = &(tt[PosHash & MAX_TT]);
+  struct tt_st e;
+  MOVE hm;
+  hm.u = 0;
+  for (i=0; i<CLUSTER_SIZE; i++, ttentry++) {
+    e.data = ttentry->data;
+    if ((ttentry->PositionHashFull ^ e.data) == PosHash) {
+      hm = e.hmove;
+      break;
+    }
+  }
+  return hm;
+}
+
+void PVFromTT(int level, int color, MOVE scratch[])
+{
+  /* Rebuilds PVTable[level] following hash moves from the current position */
+  register int k=0, c=color;
+  MOVE hm;
+  hm = ProbeHashMove((level&1) ? T_T : Opp_T_T, move_stack[mv_stack_p].PositionHash);
+  while (hm.u && level+k <= MAX_PLY && IsLegalHashMove(&hm, c, scratch)) {
+    PVTable[level][k++].u = hm.u;
+    PushStatus();
+    MakeMove(&hm);
+    if (CheckForDraw())
+      break;
+    hm = ProbeHashMove(((level+k)&1) ? T_T : Opp_T_T, move_stack[mv_stack_p].PositionHash);
+    c = NextSide(c);
+  }
+  PVLength[level] = k;
+  while (k--) {
+    RetractLastMove(); PopStatus();
+  }
+}
+
 /* -------------------------------- NEGA SCOUT ALGORITHM -------------------------------- */
 
-int NegaScout(int CanNull, int level, LINE * pline, MOVE mlst[], int n, int depth, int alpha, int beta, int color, 
+int NegaScout(int CanNull, int level, MOVE mlst[], int n, int depth, int alpha, int beta, int color, 
               int *bestMoveIndex, int IsPVnode, int BeingInCheck, MOVE * ThreatP, int FollowingPV)
 {
   register int i, e, t, x, a, w2=-1, b2=-1, NextDepth, NextColor, ngmoves=0, nChecks, CanReduct, CurrMoveFollowsPV, ngpruned=0;
   int iret=0, IsMaterialEnough, iretNull=-1, legality_checked=0, nCheckPieces, LastMoveToSquare, LastMovePieceType;
-  int IID_d, ShouldIID=1, TT_value, NullDepth;
-  MOVE w2movelst[MAXMV], b2movelst[MAXMV], CheckAttacks[MAXMV];
-  LINE line;
+  int IID_d, ShouldIID=1, TT_value, NullDepth, GivesCheck;
+  MOVE *child, *CheckAttacks = SearchStack[level].CheckAttacks;
+  struct chkinfo ci;
+  unsigned long long RootNodes=0;
+  int nQuiets=0, QuietsXY[MAX_QUIETS], QuietsPiece[MAX_QUIETS];
   MOVE Tbest, NullBest, HashBest, *GPVmp;
 
-  pline->cmove = 0;
+  PVLength[level] = 0;
   *bestMoveIndex = TERMINAL_NODE;
   HashBest.u=0;
   if (depth==0)
   { /*node is a terminal node  */
-    return Quiescence(alpha, beta, color);
+    return Quiescence(alpha, beta, color, mlst + n);
   } 
   else 
   {
     g_nodes++;
-    if (mv_stack_p - Starting_Mv > MAX_DEPTH ) { /* We are too deep */
-      return Quiescence(alpha, beta, color);
+    STATS_INC(Nodes); STATS_PLY();
+    if (mv_stack_p - Starting_Mv > MAX_DEPTH || level >= MAX_PLY || mlst + n + 2*MAXMV > ARENA_END) { /* We are too deep */
+      return Quiescence(alpha, beta, color, mlst + n);
     }
     /* Check Transposition Table for a match */
     if (!IsPVnode) {
      if (level&1) { /* Our side to move */
-      if (Check_TT(T_T, alpha, beta, depth, move_stack[mv_stack_p].PositionHash, &TT_value, &HashBest)) {
+      if (Check_TT(T_T, alpha, beta, depth, move_stack[mv_stack_p].PositionHash, &TT_value, &HashBest, color)) {
         *bestMoveIndex = TERMINAL_NODE;
-        pline->argmove[0].u = HashBest.u;
-        pline->cmove = 1;
+        PVTable[level][0].u = HashBest.u;
+        PVLength[level] = (HashBest.u != 0);
+        STATS_INC(TTCuts);
         return TT_value;
       }
      } else { /* Opponent time to move */
-      if (Check_TT(Opp_T_T, alpha, beta, depth, move_stack[mv_stack_p].PositionHash, &TT_value, &HashBest)) {
+      if (Check_TT(Opp_T_T, alpha, beta, depth, move_stack[mv_stack_p].PositionHash, &TT_value, &HashBest, color)) {
         *bestMoveIndex = TERMINAL_NODE;
-        pline->argmove[0].u = HashBest.u;
-        pline->cmove = 1;
+        PVTable[level][0].u = HashBest.u;
+        PVLength[level] = (HashBest.u != 0);
+        STATS_INC(TTCuts);
         return TT_value;
       }
      }
     } else if (level>1) {
      if (level&1) { /* Our side to move */
-      if (Check_TT_PV(T_T, depth, move_stack[mv_stack_p].PositionHash, &TT_value, &HashBest)) {
+      if (Check_TT_PV(T_T, depth, move_stack[mv_stack_p].PositionHash, &TT_value, &HashBest, color)) {
         *bestMoveIndex = TERMINAL_NODE;
-        pline->argmove[0].u = HashBest.u;
-        pline->cmove = 1;
+        PVFromTT(level, color, mlst + n);
+        STATS_INC(TTCuts);
         return TT_value;
       }
      } else { /* Opponent time to move */
-      if (Check_TT_PV(Opp_T_T, depth, move_stack[mv_stack_p].PositionHash, &TT_value, &HashBest)) {
+      if (Check_TT_PV(Opp_T_T, depth, move_stack[mv_stack_p].PositionHash, &TT_value, &HashBest, color)) {
         *bestMoveIndex = TERMINAL_NODE;
-        pline->argmove[0].u = HashBest.u;
-        pline->cmove = 1;
+        PVFromTT(level, color, mlst + n);
+        STATS_INC(TTCuts);
         return TT_value;
       }
      }
@@ -6056,6 +6820,7 @@ int NegaScout(int CanNull, int level, LINE * pline, MOVE mlst[], int n, int dept
       if (IsMaterialEnough>7 && !IsPVnode) { /* Reverse Futility Pruning */
         if (((int)move_stack[mv_stack_p].move.m.mvv_lva < TACTICAL_MARGIN)) {
           if ( ReverseFutilityPruning(depth, e, beta) ) {
+            STATS_INC(RFPrunes);
             *bestMoveIndex = TERMINAL_NODE;
             return e;
           }
@@ -6068,21 +6833,23 @@ int NegaScout(int CanNull, int level, LINE * pline, MOVE mlst[], int n, int dept
         NullDepth++;
       }
       if (CanNull && (depth > NullDepth) && (IsMaterialEnough > 5)) {
+        STATS_INC(NullTries);
         NextDepth = depth-1-NullDepth;
         if (color==black) {
           w2=0;
-          x =  - NegaScout(0, level+1, &line, w2movelst, w2, NextDepth, -beta, -alpha /*-beta+1*/, NextColor, &iretNull, IsPVnode, 0, NULL,0);
+          x =  - NegaScout(0, level+1, mlst + n, w2, NextDepth, -beta, -alpha /*-beta+1*/, NextColor, &iretNull, IsPVnode, 0, NULL,0);
           if (iretNull>=0) {
-            NullBest.u = w2movelst[iretNull].u;
+            NullBest.u = mlst[n + iretNull].u;
           }
         } else {
           b2=0;
-          x =  - NegaScout(0, level+1, &line, b2movelst, b2, NextDepth, -beta, -alpha /*-beta+1*/, NextColor, &iretNull, IsPVnode, 0, NULL,0);
+          x =  - NegaScout(0, level+1, mlst + n, b2, NextDepth, -beta, -alpha /*-beta+1*/, NextColor, &iretNull, IsPVnode, 0, NULL,0);
           if (iretNull>=0) {
-            NullBest.u = b2movelst[iretNull].u;
+            NullBest.u = mlst[n + iretNull].u;
           }
         }
         if (x>=beta) {
+          STATS_INC(NullCuts);
           *bestMoveIndex = TERMINAL_NODE;
           return x;
         }
@@ -6090,6 +6857,7 @@ int NegaScout(int CanNull, int level, LINE * pline, MOVE mlst[], int n, int dept
     }
     /* late move generation */
     if ( n==0 ) {
+      SetFollowUpContext();
       if (color==black) {
         n=FindAllBlackMoves(mlst, level-1);
       } else {
@@ -6108,17 +6876,22 @@ int NegaScout(int CanNull, int level, LINE * pline, MOVE mlst[], int n, int dept
         } else if (mlst[i].m.from==HashBest.m.from && mlst[i].m.to==HashBest.m.to) {
           mlst[i].m.mvv_lva = 126; /* Move from Hash table */
           ShouldIID = 0;
-        } else if (ThreatP && mlst[i].m.from==ThreatP->m.from && mlst[i].m.to==ThreatP->m.to)
+        } else if (ThreatP && mlst[i].m.from==ThreatP->m.from && mlst[i].m.to==ThreatP->m.to) {
           mlst[i].m.mvv_lva = 110; /* Move found as threat from previous level Null Move search */
+        } else if (mlst[i].m.mvv_lva > 0 && IsLosingCapture(&mlst[i])) {
+          mlst[i].m.mvv_lva = LOSING_CAPTURE_V; /* Losing captures are searched last */
+        }
       }
       /* Sort generated moves using native C quick-sort algorithm */
       qsort(mlst, n, sizeof(MOVE), MOVE_cmp_by_mvv_lva);
     }
+    child = mlst + n; /* children lists follow ours in the move arena */
     if (level>1) {
       if (ShouldIID && !BeingInCheck && depth>IID_DEPTH) { /* Internal Iterative Deepening */
         int utemp, maxi=-1, t_score;
         int IID_a = alpha;
         int iidLegal = 0;
+        STATS_INC(IIDs);
         IID_d = depth / 3 ;
         if (IID_d > FUTIL_DEPTH) IID_d = FUTIL_DEPTH;
         for (int i=0; i<n; i++) {
@@ -6130,7 +6903,7 @@ int NegaScout(int CanNull, int level, LINE * pline, MOVE mlst[], int n, int dept
             if (WhiteKingInCheck()) { RetractLastMove(); PopStatus(); continue; }
           }
           iidLegal++;
-          t_score = - Negalight(IID_d-1, -beta, -IID_a, NextColor);
+          t_score = - Negalight(IID_d-1, -beta, -IID_a, NextColor, mlst + n);
           RetractLastMove(); PopStatus();
           if (t_score>IID_a) {
             IID_a = t_score;
@@ -6168,19 +6941,25 @@ int NegaScout(int CanNull, int level, LINE * pline, MOVE mlst[], int n, int dept
     }
 
     a = alpha;
+    InitCheckInfo(&ci, color);
     for (i=0; i<n; i++) {
       /* foreach child of node */
-      if (CheckTime()) {
+      if (PollTime()) {
         TimeIsUp = 1;
       }
+      if (level==1) {
+        RootNodes = g_nodes;
+      }
       if (legality_checked==1) {
         if (mlst[i].m.flag==0) {
           continue;
         } else {
+          GivesCheck = MoveGivesCheck(&mlst[i], &ci);
           PushStatus();
           MakeMove(&mlst[i]);
         }
       } else {
+        GivesCheck = MoveGivesCheck(&mlst[i], &ci);
         PushStatus();
         MakeMove(&mlst[i]);
         if (color==black) {
@@ -6190,22 +6969,24 @@ int NegaScout(int CanNull, int level, LINE * pline, MOVE mlst[], int n, int dept
         }
       }
       Tbest.u = 0;
+      PVLength[level+1] = 0;
       if (CheckForDraw()) {
         t = 0;
       } else if (color==black) {
         /* if our move just played gives check, generate evasions and do not reduce depth so we can search deeper */
-        nChecks = WhiteKingInCheckInfo(CheckAttacks, &nCheckPieces);
+        nChecks = GivesCheck ? WhiteKingInCheckInfo(CheckAttacks, &nCheckPieces) : 0;
         if (nChecks) { /* early move generation  and check extension */
           CanReduct=0;
           NextDepth = depth;
-          w2=FindAllWhiteEvasions(w2movelst, CheckAttacks, nChecks, nCheckPieces);
-          qsort(w2movelst, w2, sizeof(MOVE), MOVE_cmp_by_mvv_lva);
+          STATS_INC(CheckExts);
+          w2=FindAllWhiteEvasions(child, CheckAttacks, nChecks, nCheckPieces);
+          qsort(child, w2, sizeof(MOVE), MOVE_cmp_by_mvv_lva);
         } else {
           NextDepth = depth-1;
           CanReduct = (IsMaterialEnough > 7) && (!IsPVnode) && (!BeingInCheck) && 
                       ((int)mlst[i].m.mvv_lva < TACTICAL_MARGIN);
           if ( CanReduct ) {
-            if ( FutilityPruning(NextDepth, e, a) ) { RetractLastMove(); PopStatus(); ngpruned++; continue; }
+            if ( FutilityPruning(NextDepth, e, a) ) { RetractLastMove(); PopStatus(); ngpruned++; STATS_INC(FutilPrunes); continue; }
           }
           w2=0;
         }
@@ -6218,28 +6999,33 @@ int NegaScout(int CanNull, int level, LINE * pline, MOVE mlst[], int n, int dept
           }
         }
         if (ngmoves==0) { /* First move to search- full window [-beta,-alpha] used */
-          t =  - NegaScout(1, level+1, &line, w2movelst, w2, NextDepth, -beta, -a, NextColor, &iret, PV_NODE, nChecks, &NullBest,CurrMoveFollowsPV);
+          t =  - NegaScout(1, level+1, child, w2, NextDepth, -beta, -a, NextColor, &iret, PV_NODE, nChecks, &NullBest,CurrMoveFollowsPV);
         } else {
           if (CanReduct && (ngmoves >= LMR_MOVES) && (depth > LMR_DEPTH_LIMIT)) {
             /* LMR - Search with reduced depth and scout window [-alpha-1,-alpha] */
             int lmr_d = depth-2;
             if (ngmoves >= (LMR_MOVES<<1)) lmr_d = depth-3;
-            t =  - NegaScout(1, level+1, &line, w2movelst, w2, lmr_d, -a-1, -a, NextColor, &iret, CUT_NODE, nChecks, &NullBest,CurrMoveFollowsPV);
+            t =  - NegaScout(1, level+1, child, w2, lmr_d, -a-1, -a, NextColor, &iret, CUT_NODE, nChecks, &NullBest,CurrMoveFollowsPV);
+            STATS_INC(LmrSearches);
+            #ifdef DBGSTATS
+            if (t > a) SearchStats.LmrResearches++;
+            #endif
           } else t = a+1;  /* Ensure that re-search is done. */
 
           if (t > a) {
             /* Search using normal depth and scout window [-alpha-1,-alpha] */
-            t =  - NegaScout(1, level+1, &line, w2movelst, w2, NextDepth, -a-1, -a, NextColor, &iret, CUT_NODE, nChecks, &NullBest,CurrMoveFollowsPV); 
+            t =  - NegaScout(1, level+1, child, w2, NextDepth, -a-1, -a, NextColor, &iret, CUT_NODE, nChecks, &NullBest,CurrMoveFollowsPV); 
             if ( (t > a) && (t < beta) ) {
               /* re-search using full window */
-              t = - NegaScout(1, level+1, &line, w2movelst, w2, NextDepth, -beta, -a, NextColor, &iret, PV_NODE, nChecks, &NullBest,CurrMoveFollowsPV);
+              STATS_INC(PVResearches);
+              t = - NegaScout(1, level+1, child, w2, NextDepth, -beta, -a, NextColor, &iret, PV_NODE, nChecks, &NullBest,CurrMoveFollowsPV);
             }
           }
         }
         if (iret>=0) { /* Update Best defense for later use in PV line update */
-          Tbest.u = w2movelst[iret].u;
+          Tbest.u = child[iret].u;
           if (level==1 && mlst[i].u==GlobalPV.argmove[0].u && depth>START_DEPTH+1) {
-            if (t < (ngmax - PV_CHANGE_THRESH) ) {
+            if (t < (ngmax - PV_CHANGE_THRESH) || t <= alpha) {
               danger=1;
               OutputDanger(depth, t, &Tbest);
             }
@@ -6247,18 +7033,19 @@ int NegaScout(int CanNull, int level, LINE * pline, MOVE mlst[], int n, int dept
         } 
       } else { /* color==white */
         /* if our move just played gives check do not reduce depth so we can search deeper */
-        nChecks = BlackKingInCheckInfo(CheckAttacks, &nCheckPieces);
+        nChecks = GivesCheck ? BlackKingInCheckInfo(CheckAttacks, &nCheckPieces) : 0;
         if (nChecks) { /* early move generation and check extension */
           CanReduct=0;
           NextDepth = depth;
-          b2=FindAllBlackEvasions(b2movelst, CheckAttacks, nChecks, nCheckPieces);
-          qsort(b2movelst, b2, sizeof(MOVE), MOVE_cmp_by_mvv_lva);
+          STATS_INC(CheckExts);
+          b2=FindAllBlackEvasions(child, CheckAttacks, nChecks, nCheckPieces);
+          qsort(child, b2, sizeof(MOVE), MOVE_cmp_by_mvv_lva);
         } else {
           NextDepth = depth-1;
           CanReduct = (IsMaterialEnough > 7) && (!IsPVnode) && (!BeingInCheck) && 
                       ((int)mlst[i].m.mvv_lva < TACTICAL_MARGIN);
           if ( CanReduct ) { /* Futility pruning */
-            if ( FutilityPruning(NextDepth, e, a) ) { RetractLastMove(); PopStatus(); ngpruned++; continue; }
+            if ( FutilityPruning(NextDepth, e, a) ) { RetractLastMove(); PopStatus(); ngpruned++; STATS_INC(FutilPrunes); continue; }
           }
           b2=0;
         }
@@ -6271,28 +7058,33 @@ int NegaScout(int CanNull, int level, LINE * pline, MOVE mlst[], int n, int dept
           }
         }
         if (ngmoves==0) { /* First move to search- full window [-beta,-alpha] used */
-          t =  - NegaScout(1, level+1, &line, b2movelst, b2, NextDepth, -beta, -a, NextColor, &iret, PV_NODE, nChecks, &NullBest,CurrMoveFollowsPV);
+          t =  - NegaScout(1, level+1, child, b2, NextDepth, -beta, -a, NextColor, &iret, PV_NODE, nChecks, &NullBest,CurrMoveFollowsPV);
         } else {
           if (CanReduct && (ngmoves >= LMR_MOVES) && (depth > LMR_DEPTH_LIMIT)) {
             /* LMR - Search with reduced depth and scout window [-alpha-1,-alpha] */
             int lmr_d = depth-2;
             if (ngmoves >= (LMR_MOVES<<1)) lmr_d = depth-3;
-            t =  - NegaScout(1, level+1, &line, b2movelst, b2, lmr_d, -a-1, -a, NextColor, &iret, CUT_NODE, nChecks, &NullBest,CurrMoveFollowsPV);
+            t =  - NegaScout(1, level+1, child, b2, lmr_d, -a-1, -a, NextColor, &iret, CUT_NODE, nChecks, &NullBest,CurrMoveFollowsPV);
+            STATS_INC(LmrSearches);
+            #ifdef DBGSTATS
+            if (t > a) SearchStats.LmrResearches++;
+            #endif
           } else t = a+1;  /* Ensure that re-search is done. */
 
           if (t > a) {
             /* Search normal depth and scout window [-alpha-1,-alpha] */
-            t =  - NegaScout(1, level+1, &line, b2movelst, b2, NextDepth, -a-1, -a, NextColor, &iret, CUT_NODE, nChecks, &NullBest,CurrMoveFollowsPV); 
+            t =  - NegaScout(1, level+1, child, b2, NextDepth, -a-1, -a, NextColor, &iret, CUT_NODE, nChecks, &NullBest,CurrMoveFollowsPV); 
             if ( (t > a) && (t < beta) ) {
               /* re-search using full window */
-              t = - NegaScout(1, level+1, &line, b2movelst, b2, NextDepth, -beta, -a, NextColor, &iret, PV_NODE, nChecks, &NullBest,CurrMoveFollowsPV);
+              STATS_INC(PVResearches);
+              t = - NegaScout(1, level+1, child, b2, NextDepth, -beta, -a, NextColor, &iret, PV_NODE, nChecks, &NullBest,CurrMoveFollowsPV);
             }
           }
         }
         if (iret>=0) { /* Update Best defense for later use in PV line update */
-          Tbest.u = b2movelst[iret].u;
+          Tbest.u = child[iret].u;
           if (level==1 && mlst[i].u==GlobalPV.argmove[0].u && depth>START_DEPTH+1) {
-            if (t < (ngmax - PV_CHANGE_THRESH) ) {
+            if (t < (ngmax - PV_CHANGE_THRESH) || t <= alpha) {
               danger=1;
               OutputDanger(depth, t, &Tbest);
             }
@@ -6302,37 +7094,54 @@ int NegaScout(int CanNull, int level, LINE * pline, MOVE mlst[], int n, int dept
       LastMoveToSquare  = mlst[i].m.to;
       LastMovePieceType = board[LastMoveToSquare]->type;
       RetractLastMove(); PopStatus();
-      if (TimeIsUp) {
-        if (!danger)
-          return a;
+      if (level==1) {
+        RootStats[i].nodes = g_nodes - RootNodes;
+      }
+      if (MUST_STOP_SEARCH) {
+        return a;
       }
       /*the following constitutes alpha-beta pruning*/
       if (t>a) {
         a = t;
         *bestMoveIndex = i;
-        /* Update Principal Variation */
-        if (Tbest.u) {
-          pline->argmove[0].u = Tbest.u;
-          memcpy(pline->argmove + 1, line.argmove, line.cmove * sizeof(MOVE));
-          pline->cmove = line.cmove + 1;
-        } else {
-          pline->cmove = 0;
-        }
+        /* Update Principal Variation: our move followed by the line found below it */
+        PVTable[level][0].u = mlst[i].u;
+        memcpy(&PVTable[level][1], PVTable[level+1], PVLength[level+1] * sizeof(MOVE));
+        PVLength[level] = PVLength[level+1] + 1;
         if (a>=beta) { /*-- cut-off --*/
+          STATS_INC(Cutoffs);
+          #ifdef DBGSTATS
+          if (ngmoves==0) SearchStats.FirstMoveCutoffs++;
+          #endif
           #ifdef DBGCUTOFF
           if (ngmoves==0) { /* First move of search */
             cutoffs_on_1st_move++;
           }
           total_cutoffs++;
           #endif
-          /* Update depth killers for non captures */
+          /* Update depth killers, counter moves and follow up history for non captures */
           if (board[LastMoveToSquare]->type == 0) {
+            MOVE km;
+            km.u = mlst[i].u;
+            km.m.mvv_lva = 0;
             if (color==black) {
               B_Killers[1][level-1] = B_Killers[0][level-1];
-              B_Killers[0][level-1] = mlst[i].u;
+              B_Killers[0][level-1] = km.u;
             } else {
               W_Killers[1][level-1] = W_Killers[0][level-1];
-              W_Killers[0][level-1] = mlst[i].u;
+              W_Killers[0][level-1] = km.u;
+            }
+            SetFollowUpContext();
+            UpdateFollowUp(&km, LastMovePieceType, depth);
+            /* Reward the cut-off move and penalize quiet moves searched before it */
+            if (color==black) {
+              UpdateHistory(&B_history[LastMovePieceType - BPAWN][LastMoveToSquare], depth*depth);
+              for (x=0; x<nQuiets; x++)
+                UpdateHistory(&B_history[QuietsPiece[x] - BPAWN][QuietsXY[x]], -depth*depth);
+            } else {
+              UpdateHistory(&W_history[LastMovePieceType - WPAWN][LastMoveToSquare], depth*depth);
+              for (x=0; x<nQuiets; x++)
+                UpdateHistory(&W_history[QuietsPiece[x] - WPAWN][QuietsXY[x]], -depth*depth);
             }
           }
           /* Update Transposition table */
@@ -6347,22 +7156,17 @@ int NegaScout(int CanNull, int level, LINE * pline, MOVE mlst[], int n, int dept
         if (board[LastMoveToSquare]->type == 0) {
           /* Non capture move increased alpha - increase (piece,square) history value */
           if (color==black) {
-            if (B_history[LastMovePieceType - BPAWN][LastMoveToSquare]==0) {
-              B_history[LastMovePieceType - BPAWN][LastMoveToSquare] = -MAX_DEPTH;
-            }
-            B_history[LastMovePieceType - BPAWN][LastMoveToSquare] += depth;
-            if (B_history[LastMovePieceType - BPAWN][LastMoveToSquare] >=0 )
-              B_history[LastMovePieceType - BPAWN][LastMoveToSquare] = -1;
+            UpdateHistory(&B_history[LastMovePieceType - BPAWN][LastMoveToSquare], depth);
           } else {
-            if (W_history[LastMovePieceType - WPAWN][LastMoveToSquare]==0) {
-              W_history[LastMovePieceType - WPAWN][LastMoveToSquare] = -MAX_DEPTH;
-            }
-            W_history[LastMovePieceType - WPAWN][LastMoveToSquare] += depth;
-            if (W_history[LastMovePieceType - WPAWN][LastMoveToSquare] >=0 )
-              W_history[LastMovePieceType - WPAWN][LastMoveToSquare] = -1;
+            UpdateHistory(&W_history[LastMovePieceType - WPAWN][LastMoveToSquare], depth);
           }
         }
       }
+      if (board[LastMoveToSquare]->type == 0 && nQuiets < MAX_QUIETS) {
+        QuietsXY[nQuiets] = LastMoveToSquare;
+        QuietsPiece[nQuiets] = LastMovePieceType;
+        nQuiets++;
+      }
       ngmoves++;
     }/* for each node */
     if (ngmoves==0 && ngpruned==0) {
@@ -6409,7 +7213,7 @@ int PlayAndSortMoves(MOVE q[], int n, int Nextcolor, int depth, int endL)
     } else {
       PushStatus();
       MakeMove(&q[i]);
-      sortV[i]  = - Negalight(depth-1, -INFINITY_, INFINITY_, Nextcolor);
+      sortV[i]  = - Negalight(depth-1, -INFINITY_, INFINITY_, Nextcolor, q + n);
       RetractLastMove(); PopStatus();
     } 
   }
@@ -6464,9 +7268,9 @@ void PrintMoveOutput(int depth, int Goodmove)
   } 
 }
 
-unsigned long long Perft(int depth, int color, int level, int UseHash, int UseEvasions)
+unsigned long long Perft(int depth, int color, int level, int UseHash, int UseEvasions, MOVE move_list[])
 {
-  MOVE move_list[MAXMV], CheckAttacks[MAXMV];
+  MOVE CheckAttacks[MAX_CHECK_SQ];
   register int i, n_moves, actual, nChecks;
   int nCheckPieces;
   unsigned long long nodes = 0;
@@ -6476,18 +7280,9 @@ unsigned long long Perft(int depth, int color, int level, int UseHash, int UseEv
   if (UseHash && level>1) {
     register unsigned long long key64 = move_stack[mv_stack_p].PositionHash;
     register unsigned int Indx = key64 & MAX_TT;
-    if (level&1) {
-      if (T_T[Indx].PositionHashFull == key64) {
-       if (T_T[Indx].depth == depth) {
-        return (T_T[Indx].hmove.u);
-       }
-      }
-    } else {
-      if (Opp_T_T[Indx].PositionHashFull == key64) {
-       if (Opp_T_T[Indx].depth == depth) {
-        return (Opp_T_T[Indx].hmove.u);
-       }
-      }
+    struct tt_st e = ((level&1) ? T_T : Opp_T_T)[Indx];
+    if ((e.PositionHashFull ^ e.data) == key64 && e.depth == depth) {
+      return (e.hmove.u);
     }
   }
   if (color==white) {
@@ -6505,7 +7300,7 @@ unsigned long long Perft(int depth, int color, int level, int UseHash, int UseEv
       PushStatus();
       MakeMove(&move_list[i]);
       if (WhiteKingInCheck()) { RetractLastMove(); PopStatus(); continue; }
-      nodes += Perft(depth-1, black, level+1, UseHash, UseEvasions);
+      nodes += Perft(depth-1, black, level+1, UseHash, UseEvasions, move_list + n_moves);
       RetractLastMove(); PopStatus();
     }
   } else {
@@ -6523,215 +7318,182 @@ unsigned long long Perft(int depth, int color, int level, int UseHash, int UseEv
       PushStatus();
       MakeMove(&move_list[i]);
       if (BlackKingInCheck()) { RetractLastMove(); PopStatus(); continue; }
-      nodes += Perft(depth-1, white, level+1, UseHash, UseEvasions);
+      nodes += Perft(depth-1, white, level+1, UseHash, UseEvasions, move_list + n_moves);
       RetractLastMove(); PopStatus();
     }
   }
   if (UseHash) {
     register unsigned int Indx = move_stack[mv_stack_p].PositionHash & MAX_TT;
-    if (level&1) {
-      T_T[Indx].hmove.u = nodes;
-      T_T[Indx].depth = depth;
-      T_T[Indx].PositionHashFull = move_stack[mv_stack_p].PositionHash;
-    } else {
-      Opp_T_T[Indx].hmove.u = nodes;
-      Opp_T_T[Indx].depth = depth;
-      Opp_T_T[Indx].PositionHashFull = move_stack[mv_stack_p].PositionHash;
-    }
+    struct tt_st *e = &((level&1) ? T_T : Opp_T_T)[Indx];
+    e->data = 0;
+    e->hmove.u = nodes;
+    e->depth = depth;
+    e->PositionHashFull = move_stack[mv_stack_p].PositionHash ^ e->data;
   }
   return nodes;
 }
 
-int GetWhiteBestMove(MOVE *mP)
+void SortRootMoves(MOVE movelst[], int n, int best)
 {
-  int ret=0, d, w_moves, e, IsMaterialEnough, actual, unique, i;
-  int tempNG, sortMax, Alpha, Beta, InCheck;
-  MOVE wmovelst[MAXMV], Threat;
-  LINE line;
-  InitTime();
-  g_nodes = 0;
+  /* Best move first, then the rest by nodes spent on them in the last iteration */
+  struct rootst temp;
+  int i;
+  for (i=0; i<n; i++) {
+    RootStats[i].move.u = movelst[i].u;
+  }
+  if (best>0) {
+    temp = RootStats[0];
+    RootStats[0] = RootStats[best];
+    RootStats[best] = temp;
+  }
+  qsort(RootStats + 1, n - 1, sizeof(struct rootst), ROOT_cmp_by_nodes);
+  for (i=0; i<n; i++) {
+    movelst[i].u = RootStats[i].move.u;
+  }
+}
 
-  #ifdef DBGCUTOFF
-  cutoffs_on_1st_move = total_cutoffs = 0ULL;
-  #endif
+/* ----------------------- EPD TEST SUITES -------------------------------------- */
 
-  Starting_Mv=mv_stack_p;
-  w_moves=FindAllWhiteMoves(wmovelst);
-  actual=0;
-  for (i=0; i<w_moves; i++) {
-    PushStatus();
-    MakeMove(&wmovelst[i]);
-    if (WhiteKingInCheck()) {
-      RetractLastMove(); PopStatus();
-      wmovelst[i].m.flag=0;
-      wmovelst[i].m.mvv_lva= -126;
-      continue;
-    }
-    RetractLastMove(); PopStatus();
-    unique=i;
-    actual++;
+#define EPD_MAX_MOVES 8
+#define EPD_SECS      5 /* default time per position */
+
+struct epd_st {
+  int active, nbm, nam;
+  MOVE bm[EPD_MAX_MOVES], am[EPD_MAX_MOVES];
+  int SolvedDepth;      /* -1: the PV move is not a solution */
+  long long SolvedTime; /* ms from the start of the search */
+  unsigned long long SolvedNodes;
+} Epd;
+
+int SameMove(MOVE *a, MOVE *b)
+{
+  return (a->m.from==b->m.from && a->m.to==b->m.to && a->m.flag==b->m.flag);
+}
+
+int EpdMoveSolves(MOVE *mp)
+{
+  /* best move among bm, or a move that is not among am */
+  int i;
+  for (i=0; i<Epd.nbm; i++) {
+    if (SameMove(mp, &Epd.bm[i]))
+      return 1;
   }
-  if (actual>1)
-    qsort(wmovelst, w_moves, sizeof(MOVE), MOVE_cmp_by_mvv_lva);
-  if (actual==0) {
-    if (WhiteKingInCheck()) {
-      if (Xoutput==_NORMAL_OUTPUT) {
-        ExitErrorMesg("Black Mates.  GAME OVER  (0 - 1)");
-      } else if (Xoutput==_XBOARD_OUTPUT) {
-        printf("0-1 {Black Mates}\n");
-      }
-    } else {
-      if (Xoutput==_NORMAL_OUTPUT) {
-        ExitErrorMesg("Drawn. Stalemate.  GAME OVER  (1/2 - 1/2)");
-      } else if (Xoutput==_XBOARD_OUTPUT) {
-        printf("1/2-1/2 {Draw. Stalemate.}\n");
-      }
-    }
-    return 0;
+  for (i=0; i<Epd.nam; i++) {
+    if (SameMove(mp, &Epd.am[i]))
+      return 0;
   }
-  if (IsBookLine(&ret,wmovelst,w_moves, white)) {
-    mP->u = wmovelst[ret].u;
-    return 1;
-  } else {
-    MOVE failsafe_move;
-    e = StaticEval(&IsMaterialEnough);
+  return (Epd.nbm==0 && mp->u!=0);
+}
 
-    if (IsMaterialEnough==0) {
-      if (Xoutput==_NORMAL_OUTPUT) {
-        ExitErrorMesg("Drawn. Not enought pieces for mate.  GAME OVER  (1/2 - 1/2)");
-      } else if (Xoutput==_XBOARD_OUTPUT) {
-        printf("1/2-1/2 {Draw. Not enough material.}\n");
-        return 0;
-      }
-    }
-    ret=0;
-    if (actual==1) {
-      mP->u = wmovelst[unique].u;
-      return 1;
-    } else {
-     InCheck = WhiteKingInCheck();
-     if (InCheck) {
-       Threat.u = 0;
-     } else { /*-- First Try to find threat for opponent --*/
-       int key=-1, actual_oppn;
-       MOVE thrlst[MAXMV];
-       int oppn = FindAllBlackMoves(thrlst);
-       actual_oppn=0;
-       for (i=0; i<oppn; i++) {
-         PushStatus();
-         MakeMove(&thrlst[i]);
-         if (BlackKingInCheck()) {
-           thrlst[i].m.flag=0;
-           thrlst[i].m.mvv_lva= -126;
-           RetractLastMove(); PopStatus();
-           continue;
-         }
-         RetractLastMove(); PopStatus();
-         actual_oppn++;
-       }
-       qsort(thrlst, oppn, sizeof(MOVE), MOVE_cmp_by_mvv_lva);
-       if (actual_oppn>THREAT_THRESH) {
-         /* Find threat using a shallow negamax search */
-         if (PlayAndSortMoves(thrlst, oppn, white/*--next color is ours--*/, THREAT_DEPTH, 1/*1 move needed*/)) {
-           Threat.u = thrlst[0].u;
-           if (Xoutput==_NORMAL_OUTPUT)
-             printf("\n Black's Threat is %s (found in %7.2lf seconds)\n",  TranslateMoves(&Threat), SECONDS_PASSED);
-         } else {
-           Threat.u = 0;
-         }
-       }
-     }
-     /*-- Then Sort Our starting move list using a very shallow negamax search --*/
-     sortMax=PlayAndSortMoves(wmovelst, w_moves, black, THREAT_DEPTH+1, w_moves);
-     if (Xoutput==_NORMAL_OUTPUT) {
-       printf("\nInitial Eval:%d\n",sortMax);
-       printf("\nDepth Eval  Seconds Principal Variation  \n ---  ----  ------- -------------------\n");
-     }
-     failsafe_move.u = wmovelst[0].u;
-     TimeIsUp = 0;
+void EpdIteration(int depth)
+{
+  /* Called after every completed iteration: the solution counts from the
+     iteration where it became the PV move and stayed there */
+  if (!EpdMoveSolves(&GlobalPV.argmove[0])) {
+    Epd.SolvedDepth = -1;
+  } else if (Epd.SolvedDepth < 0) {
+    Epd.SolvedDepth = depth;
+    Epd.SolvedTime  = GetMillisecs() - start_time;
+    Epd.SolvedNodes = g_nodes;
+  }
+}
 
-     /* If opponent answered following previous PV, add the computer reply choice first in the moves list*/
-     if (PlayerMove.u!=0 && 
-         GlobalPV.argmove[1].m.flag==PlayerMove.m.flag  &&
-         GlobalPV.argmove[1].m.from==PlayerMove.m.from  &&
-         GlobalPV.argmove[1].m.to==PlayerMove.m.to        
-         ) 
-     {
-       FindAndUpdateInPlace(wmovelst, w_moves, GlobalPV.argmove[2],0);
-       if (Xoutput==_NORMAL_OUTPUT)
-         printf("Previous PV followed\n");
-     }
-     for (d=START_DEPTH; d<=MAX_DEPTH; d++) { /* Iterative deepening method*/ 
-      danger = 0;
-      /* If depth sufficient, then put previous PV[0] first in move list */
-      if (d>START_DEPTH) {
-        FindAndUpdateInPlace(wmovelst, w_moves, GlobalPV.argmove[0],0);
-      } 
-      Alpha = -INFINITY_;
-      Beta  =  INFINITY_;
-      tempNG = NegaScout(0, 1, &line, wmovelst, w_moves,  d, Alpha, Beta, white, &ret, PV_NODE, InCheck, &Threat, 1);
-      if (TimeIsUp) {
-        if (d == START_DEPTH) {
-            mP->u = failsafe_move.u;
-            return 1;
-        }
-        if (!danger)
-          break;
-      }
-      if (ret>=0) {
-        int exclamation=0;
-        ngmax = tempNG;
-        GlobalPV.argmove[0].u = wmovelst[ret].u;
-        memcpy(GlobalPV.argmove + 1, line.argmove, line.cmove * sizeof(MOVE));
-        GlobalPV.cmove  = line.cmove + 1;
-        exclamation = (d>START_DEPTH) && ((tempNG-sortMax) > PV_CHANGE_THRESH);
-        PrintMoveOutput(d, exclamation);
-      }
-      if ( (ngmax > MATE_CUTOFF || ngmax < -MATE_CUTOFF) && (d>FUTIL_DEPTH) )
-        break;
-      PrevNgmax=ngmax;
-     }
-     #ifdef DBGCUTOFF
-     if (Xoutput==_NORMAL_OUTPUT)
-       printf("\n Cutoff on 1st move is %4.2lf%% \n", 100.0*((double)cutoffs_on_1st_move)/((double)total_cutoffs) );
-     #endif
+void FillEngineInfo(NG_ENGINE *e, int depth)
+{
+  /* NG_INFO from the current PV */
+  int i, len=0;
+  e->best.u = GlobalPV.argmove[0].u;
+  strcpy(e->bestmove, (GlobalPV.cmove > 0) ? TranslateMoves(&GlobalPV.argmove[0]) : "");
+  e->pv[0] = '\0';
+  for (i=0; i<GlobalPV.cmove; i++)
+    len += sprintf(e->pv+len, (i) ? " %s" : "%s", TranslateMoves(&GlobalPV.argmove[i]));
+  e->info.depth = depth;
+  e->info.score = ngmax;
+  e->info.time = GetMillisecs() - start_time;
+  e->info.nodes = g_nodes;
+  e->info.bestmove = e->bestmove;
+  e->info.pv = e->pv;
+}
 
-     if ( ngmax < -RESIGN_EVAL ) {
-       if (Xoutput==_NORMAL_OUTPUT) {
-        ExitErrorMesg("White resigns.  GAME OVER  (0 - 1)");
-       } else if (Xoutput==_XBOARD_OUTPUT) {
-        printf("0-1 {White resigns}\n");
-        return 0;
-       }
-     }
-    }
-  }
-  mP->u = GlobalPV.argmove[0].u;
-  return 1;
+void ReportIteration(NG_ENGINE *e, int depth)
+{
+  FillEngineInfo(e, depth);
+  InfoCallback(&e->info, InfoUser);
 }
 
-int GetBlackBestMove(MOVE *mP)
+#ifdef DBGSTATS
+void PrintSearchStats(int depth, int complete)
 {
-  int ret=0, d, black_moves, e, IsMaterialEnough, actual, unique, i;
-  int tempNG, sortMax, Alpha, Beta, InCheck;
-  MOVE bmovelst[MAXMV], Threat;
-  LINE line;
+  /* One line of key=value pairs per iteration, on stderr */
+  struct stats_st *sp = &SearchStats;
+  unsigned long long IterNodes = sp->Nodes + sp->QNodes;
+  int i, last=0;
+  fprintf(stderr, "stats depth=%d complete=%d nodes=%llu main=%llu qnodes=%llu ebf=%.2lf", depth, complete,
+          IterNodes, sp->Nodes, sp->QNodes, StatsPrevNodes ? ((double)IterNodes)/StatsPrevNodes : 0.0);
+  fprintf(stderr, " tt_cut=%llu qtt_cut=%llu rfp=%llu futility=%llu null_try=%llu null_cut=%llu",
+          sp->TTCuts, sp->QTTCuts, sp->RFPrunes, sp->FutilPrunes, sp->NullTries, sp->NullCuts);
+  fprintf(stderr, " lmr=%llu lmr_research=%llu pvs_research=%llu iid=%llu check_ext=%llu cutoffs=%llu first_cutoffs=%llu",
+          sp->LmrSearches, sp->LmrResearches, sp->PVResearches, sp->IIDs, sp->CheckExts, sp->Cutoffs, sp->FirstMoveCutoffs);
+  for (i=0; i<=MAX_PLY; i++) {
+    if (sp->PlyNodes[i])
+      last = i;
+  }
+  fprintf(stderr, " ply=");
+  for (i=0; i<=last; i++) {
+    fprintf(stderr, (i<last) ? "%llu," : "%llu", sp->PlyNodes[i]);
+  }
+  fprintf(stderr, "\n");
+  StatsPrevNodes = IterNodes;
+  memset(sp, 0, sizeof(*sp));
+}
+#endif
+
+int GetBestMove(MOVE *mP, int color)
+{
+  int ret=0, d, n_moves, e, IsMaterialEnough, actual, unique, i;
+  int tempNG, sortMax, Alpha, Beta, window, InCheck, opp=NextSide(color);
+  MOVE *movelst = MoveArena, Threat;
   InitTime();
   Starting_Mv=mv_stack_p;
+  RootColor=color;
+  if (SharedHashName) { /* each shared table keeps one side to move, whatever our root side */
+    T_T = SharedTT[color!=white];
+    Opp_T_T = SharedTT[color==white];
+  }
   g_nodes = 0;
+  CompletedDepth = 0;
+  ProfReset();
+  NodeLimit = max_nodes;
+  if (Deterministic) {
+    if (!NodeLimit)
+      NodeLimit = max_time * DETERMINISTIC_NPMS;
+    ClearHashTables();
+    ResetHistory();
+  } else if (HistoryRoot >= 0 && mv_stack_p != HistoryRoot) { /* not for hint, analysis or a new search of the same root */
+    AgeHistory(mv_stack_p - HistoryRoot);
+  }
+  HistoryRoot = mv_stack_p;
   #ifdef DBGCUTOFF
   cutoffs_on_1st_move = total_cutoffs = 0ULL;
   #endif
+  #ifdef DBGSTATS
+  memset(&SearchStats, 0, sizeof(SearchStats));
+  StatsPrevNodes = 0;
+  #endif
 
-  black_moves=FindAllBlackMoves(bmovelst);
+  if (color==white) {
+    n_moves=FindAllWhiteMoves(movelst);
+  } else {
+    n_moves=FindAllBlackMoves(movelst);
+  }
   actual=0;
-  for (i=0; i<black_moves; i++) {
+  for (i=0; i<n_moves; i++) {
     PushStatus();
-    MakeMove(&bmovelst[i]);
-    if (BlackKingInCheck()) {
+    MakeMove(&movelst[i]);
+    if ((color==white) ? WhiteKingInCheck() : BlackKingInCheck()) {
       RetractLastMove(); PopStatus();
-      bmovelst[i].m.flag=0;
-      bmovelst[i].m.mvv_lva= -126;
+      movelst[i].m.flag=0;
+      movelst[i].m.mvv_lva= -126;
       continue;
     }
     RetractLastMove(); PopStatus();
@@ -6739,26 +7501,25 @@ int GetBlackBestMove(MOVE *mP)
     actual++;
   }
   if (actual>1)
-    qsort(bmovelst, black_moves, sizeof(MOVE), MOVE_cmp_by_mvv_lva);
+    qsort(movelst, n_moves, sizeof(MOVE), MOVE_cmp_by_mvv_lva);
   if (actual==0) {
-    if (BlackKingInCheck()) {
+    if ((color==white) ? WhiteKingInCheck() : BlackKingInCheck()) {
       if (Xoutput==_NORMAL_OUTPUT) {
-        ExitErrorMesg("White Mates.  GAME OVER  (1 - 0)");
+        ExitErrorMesg((color==white) ? "Black Mates.  GAME OVER  (0 - 1)" : "White Mates.  GAME OVER  (1 - 0)");
       } else if (Xoutput==_XBOARD_OUTPUT) {
-        printf("1-0 {White Mates}\n");
-        return 0;
+        printf((color==white) ? "0-1 {Black Mates}\n" : "1-0 {White Mates}\n");
       }
     } else {
       if (Xoutput==_NORMAL_OUTPUT) {
         ExitErrorMesg("Drawn. Stalemate.  GAME OVER  (1/2 - 1/2)");
       } else if (Xoutput==_XBOARD_OUTPUT) {
         printf("1/2-1/2 {Draw. Stalemate.}\n");
-        return 0;
       }
-    } 
+    }
+    return 0;
   }
-  if (IsBookLine(&ret,bmovelst,black_moves, black)) {
-    mP->u = bmovelst[ret].u;
+  if (IsBookLine(&ret,movelst,n_moves, color)) {
+    mP->u = movelst[ret].u;
     return 1;
   } else {
     MOVE failsafe_move;
@@ -6770,25 +7531,30 @@ int GetBlackBestMove(MOVE *mP)
       } else if (Xoutput==_XBOARD_OUTPUT) {
         printf("1/2-1/2 {Draw. Not enough material.}\n");
         return 0;
+      } else { /* a drawn result with a legal move for the callers that go on */
+        ngmax = 0;
+        GlobalPV.cmove = 0;
+        mP->u = movelst[0].u;
+        return 1;
       }
     }
     ret=0;
     if (actual==1) {
-      mP->u = bmovelst[unique].u;
+      mP->u = movelst[unique].u;
       return 1;
     } else {
-     InCheck = BlackKingInCheck();
+     InCheck = (color==white) ? WhiteKingInCheck() : BlackKingInCheck();
      if (InCheck) {
        Threat.u = 0;
      } else { /*-- First Try to find threat for opponent --*/
        int key=-1, actual_oppn;
-       MOVE thrlst[MAXMV];
-       int oppn = FindAllWhiteMoves(thrlst);
+       MOVE *thrlst = movelst + n_moves;
+       int oppn = (opp==white) ? FindAllWhiteMoves(thrlst) : FindAllBlackMoves(thrlst);
        actual_oppn=0;
        for (i=0; i<oppn; i++) {
          PushStatus();
          MakeMove(&thrlst[i]);
-         if (WhiteKingInCheck()) {
+         if ((opp==white) ? WhiteKingInCheck() : BlackKingInCheck()) {
            RetractLastMove(); PopStatus();
            thrlst[i].m.flag=0;
            thrlst[i].m.mvv_lva= -126;
@@ -6799,64 +7565,98 @@ int GetBlackBestMove(MOVE *mP)
        }
        qsort(thrlst, oppn, sizeof(MOVE), MOVE_cmp_by_mvv_lva);
        if (actual_oppn>THREAT_THRESH) {
-         if (PlayAndSortMoves(thrlst, oppn, black/*next color*/, THREAT_DEPTH, 1/*we need only threat move*/)) {
+         /* Find threat using a shallow negamax search */
+         if (PlayAndSortMoves(thrlst, oppn, color/*--next color is ours--*/, THREAT_DEPTH, 1/*1 move needed*/)) {
            Threat.u = thrlst[0].u;
            if (Xoutput==_NORMAL_OUTPUT)
-             printf("\n White's Threat is %s (found in %7.2lf seconds)\n",  TranslateMoves(&Threat), SECONDS_PASSED);
+             printf("\n %s's Threat is %s (found in %7.2lf seconds)\n", (opp==white) ? "White" : "Black", TranslateMoves(&Threat), SECONDS_PASSED);
          } else {
            Threat.u = 0;
          }
        }
      }
-     /*-- Then Sort Our starting moves using a very shallow negamax search --*/
-     sortMax = PlayAndSortMoves(bmovelst, black_moves, white, THREAT_DEPTH+1, black_moves);
+     /*-- Then Sort Our starting move list using a very shallow negamax search --*/
+     sortMax=PlayAndSortMoves(movelst, n_moves, opp, THREAT_DEPTH+1, n_moves);
      if (Xoutput==_NORMAL_OUTPUT) {
        printf("\nInitial Eval:%d\n",sortMax);
        printf("\nDepth Eval  Seconds Principal Variation  \n ---  ----  ------- -------------------\n");
      }
-     failsafe_move.u = bmovelst[0].u;
+     failsafe_move.u = movelst[0].u;
      TimeIsUp = 0;
-     /* If opponent answered following previous PV add the computer reply choice first in the moves list */
-     if (PlayerMove.u!=0 &&
+     memset(RootStats, 0, sizeof(RootStats));
+
+     /* If opponent answered following previous PV, add the computer reply choice first in the moves list*/
+     if (PlayerMove.u!=0 && 
          GlobalPV.argmove[1].m.flag==PlayerMove.m.flag  &&
          GlobalPV.argmove[1].m.from==PlayerMove.m.from  &&
          GlobalPV.argmove[1].m.to==PlayerMove.m.to        
          ) 
      {
-       FindAndUpdateInPlace(bmovelst, black_moves, GlobalPV.argmove[2],0);
+       FindAndUpdateInPlace(movelst, n_moves, GlobalPV.argmove[2],0);
        if (Xoutput==_NORMAL_OUTPUT)
          printf("Previous PV followed\n");
      }
-     for (d=START_DEPTH; d<=MAX_DEPTH; d++) { /* Iterative deepening method */
+     for (d=START_DEPTH; d<=max_depth; d++) { /* Iterative deepening method*/ 
       danger = 0;
-      /* If depth sufficient then put previous PV[0] first in move list */
+      /* If depth sufficient, then put previous PV[0] first in move list */
       if (d>START_DEPTH) {
-        FindAndUpdateInPlace(bmovelst, black_moves, GlobalPV.argmove[0],0);
+        FindAndUpdateInPlace(movelst, n_moves, GlobalPV.argmove[0],0);
       } 
       Alpha = -INFINITY_;
       Beta  =  INFINITY_;
-      tempNG = NegaScout(0, 1, &line, bmovelst, black_moves,  d, Alpha, Beta, black, &ret, PV_NODE, InCheck, &Threat, 1);
+      window = ASPIRATION_WINDOW;
+      if (d>START_DEPTH && ngmax > -MATE_CUTOFF && ngmax < MATE_CUTOFF) {
+        /* Aspiration window centred on previous iteration score */
+        Alpha = ngmax - window;
+        Beta  = ngmax + window;
+      }
+      for (;;) {
+        tempNG = NegaScout(0, 1, movelst, n_moves,  d, Alpha, Beta, color, &ret, PV_NODE, InCheck, &Threat, 1);
+        if (MUST_STOP_SEARCH)
+          break;
+        window <<= 1;
+        if (tempNG <= Alpha && Alpha > -INFINITY_) { /* Fail low. Search more even if time is up */
+          danger = 1;
+          Alpha = (tempNG - window > -INFINITY_) ? tempNG - window : -INFINITY_;
+        } else if (tempNG >= Beta && Beta < INFINITY_) { /* Fail high. Search the new best move first */
+          Beta = (tempNG + window < INFINITY_) ? tempNG + window : INFINITY_;
+          if (ret>0)
+            FindAndUpdateInPlace(movelst, n_moves, movelst[ret], 0);
+        } else {
+          break;
+        }
+      }
+      #ifdef DBGSTATS
+      PrintSearchStats(d, !MUST_STOP_SEARCH);
+      #endif
       if (TimeIsUp) {
         if (d == START_DEPTH) {
             mP->u = failsafe_move.u;
             return 1;
         }
-        if (!danger)
+        if (MUST_STOP_SEARCH)
           break;
       }
       if (ret>=0) {
         int exclamation=0;
         ngmax = tempNG;
-        GlobalPV.argmove[0].u = bmovelst[ret].u;
-        memcpy(GlobalPV.argmove + 1, line.argmove, line.cmove * sizeof(MOVE));
-        GlobalPV.cmove  = line.cmove + 1;
-        exclamation  = (d>START_DEPTH) && ((tempNG-sortMax) > PV_CHANGE_THRESH);
+        CompletedDepth = d;
+        GlobalPV.cmove = (PVLength[1] < MAX_DEPTH+2) ? PVLength[1] : MAX_DEPTH+2;
+        memcpy(GlobalPV.argmove, PVTable[1], GlobalPV.cmove * sizeof(MOVE));
+        exclamation = (d>START_DEPTH) && ((tempNG-sortMax) > PV_CHANGE_THRESH);
         PrintMoveOutput(d, exclamation);
+        /* Order root moves for next iteration by the effort spent on their subtrees */
+        SortRootMoves(movelst, n_moves, ret);
+        if (Epd.active)
+          EpdIteration(d);
+        if (InfoCallback)
+          ReportIteration(&TheEngine, d);
       }
       if ( (ngmax > MATE_CUTOFF || ngmax < -MATE_CUTOFF) && (d>FUTIL_DEPTH) )
         break;
       PrevNgmax=ngmax;
      }
+     ProfReport();
      #ifdef DBGCUTOFF
      if (Xoutput==_NORMAL_OUTPUT)
        printf("\n Cutoff on 1st move is %4.2lf%% \n", 100.0*((double)cutoffs_on_1st_move)/((double)total_cutoffs) );
@@ -6864,14 +7664,14 @@ int GetBlackBestMove(MOVE *mP)
 
      if ( ngmax < -RESIGN_EVAL ) {
        if (Xoutput==_NORMAL_OUTPUT) {
-        ExitErrorMesg("Black resigns.  GAME OVER  (1 - 0)");
+        ExitErrorMesg((color==white) ? "White resigns.  GAME OVER  (0 - 1)" : "Black resigns.  GAME OVER  (1 - 0)");
        } else if (Xoutput==_XBOARD_OUTPUT) {
-        printf("1-0 {Black resigns}\n");
+        printf((color==white) ? "0-1 {White resigns}\n" : "1-0 {Black resigns}\n");
         return 0;
        }
      }
-    } 
-  } 
+    }
+  }
   mP->u = GlobalPV.argmove[0].u;
   return 1;
 }
@@ -6973,7 +7773,6 @@ void UpdateSpecialConditions(MOVE  *amovep)
   if (wh_pieces==1 && Edge[wking]) {
     LoneKingReachedEdge = 1;
   }
-  ResetHistory();
 }
 
 void Play(void)
@@ -6981,6 +7780,9 @@ void Play(void)
  int i, wn, bn, from, to, fl, actual;
  MOVE amove, wmoves[MAXMV], bmoves[MAXMV];
  int e, IsMaterialEnough;
+ if (side==black) { /* position set up with black to move */
+   goto PlayBlack;
+ }
  for (;;) {
 PlayWhite:
   side=white;
@@ -7012,8 +7814,9 @@ PlayWhite:
   if ( ComputerSide == white) {
     printf("\n Board before Computer starts thinking ");
     ShowBoard();
-    if (!GetWhiteBestMove(&amove))
+    if (!NGSearch(Engine, NULL, NULL, NULL))
       continue;
+    amove.u = Engine->best.u;
     UpdateSpecialConditions(&amove);
     printf("\n Computer decided to play: %s in %7.2lf secs",TranslateMoves(&amove), SECONDS_PASSED);
   } else {
@@ -7089,8 +7892,9 @@ PlayBlack:
   if (ComputerSide == black) {
     printf("\n Board before Computer starts thinking ");
     ShowBoard();
-    if (!GetBlackBestMove(&amove))
+    if (!NGSearch(Engine, NULL, NULL, NULL))
       continue;
+    amove.u = Engine->best.u;
     UpdateSpecialConditions(&amove);
     printf("\n Computer decided to play : %s in %7.2lf secs",TranslateMoves(&amove), SECONDS_PASSED);
   } else {
@@ -7384,88 +8188,315 @@ void ReadXboardPosition(void)
   PlayerMove.u=0;
 }
 
-void CheckSpecialDrawRules(void)
+int PlacePiece(int ptype, int xy)
 {
-  int e, IsMaterialEnough;
-  e = StaticEval(&IsMaterialEnough);
-  if (IsMaterialEnough==0) {
-    printf("1/2-1/2 {Draw. Not enough material.}\n");
-  } else  if (HashRepetitions() == 3) {
-    printf("1/2-1/2 {Draw by repetition}\n");
-  } else if (FiftyMoves>=100) {
-    printf("1/2-1/2 {Draw by fifty moves rule}\n");
+  /* Put a piece in its usual slot of the piece list, extra (promoted) pieces in free pawn slots */
+  PIECE *pp = (ptype > black) ? Bpieces : Wpieces;
+  int i, first, last;
+  switch ((ptype > black) ? ptype - (BPAWN-WPAWN) : ptype) {
+    case WKING  : first = 0; last = 0; break;
+    case WQUEEN : first = 1; last = 1; break;
+    case WROOK  : first = 2; last = 3; break;
+    case WBISHOP: first = 4; last = 5; break;
+    case WKNIGHT: first = 6; last = 7; break;
+    default     : first = 8; last = 15; break;
+  }
+  for (i=first; i<=last; i++) {
+    if (pp[i].xy==0)
+      break;
+  }
+  if (i > last) { /* promoted piece */
+    for (i=8; i<16; i++) {
+      if (pp[i].xy==0)
+        break;
+    }
+    if (i==16)
+      return 0;
   }
+  pp[i].type = ptype;
+  pp[i].xy = xy;
+  board[xy] = &pp[i];
+  if (ptype==WKING) {
+    wking = xy;
+  } else if (ptype==BKING) {
+    bking = xy;
+  }
+  return 1;
 }
 
-void CheckForMate(void)
+const char FenPieceChar[PIECEMAX+1] = "  PNBRQK    pnbrqk";
+
+struct saved_board_st {
+  PIECE w[16], b[16], *board[120];
+  int wking, bking, gflags, EnPassantSq;
+};
+
+void SaveBoard(struct saved_board_st *sb)
 {
-  MOVE xmoves[MAXMV];
-  int i, n, actual=0;
-  if (side==white) {
-    n=FindAllWhiteMoves(xmoves);
-    for (i=0; i<n; i++) {
-      PushStatus();
-      MakeMove(&xmoves[i]);
-      if (WhiteKingInCheck()) { RetractLastMove(); PopStatus(); continue; }
-      RetractLastMove(); PopStatus();
-      actual++;
-      break;
-    }
-    if (actual==0) {
-      if (WhiteKingInCheck()) {
-        printf("0-1 {Black Checkmates}\n");
-      } else {
-        printf("1/2-1/2 {Stalemate}\n");
-      }
-    }
-  } else {
-    n=FindAllBlackMoves(xmoves);
-    for (i=0; i<n; i++) {
-      PushStatus();
-      MakeMove(&xmoves[i]);
-      if (BlackKingInCheck()) { RetractLastMove(); PopStatus(); continue; }
-      RetractLastMove();
-      PopStatus();
-      actual++;
-      break;
-    }
-    if (actual==0) {
-      if (BlackKingInCheck()) {
-        printf("1-0 {White Checkmates}\n");
-      } else {
-        printf("1/2-1/2 {Stalemate}\n");
-      }
-    }
-  }
+  /* The piece lists link within Wpieces/Bpieces, so copies of the arrays stay valid */
+  memcpy(sb->w, Wpieces, sizeof(sb->w));
+  memcpy(sb->b, Bpieces, sizeof(sb->b));
+  memcpy(sb->board, board, sizeof(sb->board));
+  sb->wking = wking;
+  sb->bking = bking;
+  sb->gflags = gflags;
+  sb->EnPassantSq = EnPassantSq;
 }
 
-#define AVERAGE_MOVE_NO 40
+void RestoreBoard(struct saved_board_st *sb)
+{
+  memcpy(Wpieces, sb->w, sizeof(sb->w));
+  memcpy(Bpieces, sb->b, sizeof(sb->b));
+  memcpy(board, sb->board, sizeof(sb->board));
+  wking = sb->wking;
+  bking = sb->bking;
+  gflags = sb->gflags;
+  EnPassantSq = sb->EnPassantSq;
+}
 
-void xboard(void)
+int ReadFEN(const char *fen, int *colorP)
 {
-  char line[256], command[256];
-  int moveNo=AVERAGE_MOVE_NO, TimeMins, Incr;
-  int x_start_ply, protover;
-  MOVE amove;
-  side=white;
-  ComputerSide=none;   /* no engine at start */
-  max_time = 15000; /* by default 15 seconds/move */
+  /* Returns 0 with the current position left as it was if the FEN is not a legal position */
+  int squares[64], file=0, rank=7, n, wk=0, bk=0, i, t, halfmoves=0, fullmoves=1;
+  char stm='w', castle[8]="-", ep[4]="-";
+  const char *cp;
+  struct saved_board_st saved;
+  for (i=0; i<64; i++)
+    squares[i] = 0;
+  for (cp=fen; *cp==' '; cp++) ;
+  for (; *cp && *cp!=' '; cp++) {
+    if (*cp=='/') {
+      if (file!=8 || rank==0)
+        return 0;
+      file = 0;
+      rank--;
+    } else if (*cp>='1' && *cp<='8') {
+      file += *cp - '0';
+      if (file > 8)
+        return 0;
+    } else {
+      for (t=WPAWN; t<PIECEMAX; t++) {
+        if (FenPieceChar[t]==*cp)
+          break;
+      }
+      if (t==PIECEMAX || file > 7)
+        return 0;
+      squares[8*rank + file] = t;
+      if (t==WKING) wk++;
+      if (t==BKING) bk++;
+      file++;
+    }
+  }
+  if (rank!=0 || file!=8 || wk!=1 || bk!=1)
+    return 0;
+  n = sscanf(cp, " %c %7s %3s %d %d", &stm, castle, ep, &halfmoves, &fullmoves);
+  if (n < 1 || (stm!='w' && stm!='b'))
+    return 0;
+
+  SaveBoard(&saved);
+  EmptyBoard();
+  for (i=0; i<64; i++) {
+    if (squares[i] && !PlacePiece(squares[i], board64[i])) { /* more pieces than slots */
+      RestoreBoard(&saved);
+      return 0;
+    }
+  }
+  /* Unlink the pieces that are not on the board */
+  for (PIECE *p=Bpieces[0].next; p!=NULL; p=p->next) {
+    if (p->xy == 0) {
+      p->prev->next = p->next;
+      if (p->next)
+        p->next->prev = p->prev;
+    }
+  }
+  for (PIECE *p=Wpieces[0].next; p!=NULL; p=p->next) {
+    if (p->xy == 0) {
+      p->prev->next = p->next;
+      if (p->next)
+        p->next->prev = p->prev;
+    }
+  }
+  /* castling flags: a right is kept only with king and rook on their squares */
+  gflags = 1|2|4|8|16|32;
+  if (wking==E1) {
+    if (strchr(castle,'K') && board[H1]->type==WROOK) gflags &= ~(1|4);
+    if (strchr(castle,'Q') && board[A1]->type==WROOK) gflags &= ~(1|2);
+  } else {
+    gflags |= 64; /* WHasCastled */
+  }
+  if (bking==E8) {
+    if (strchr(castle,'k') && board[H8]->type==BROOK) gflags &= ~(8|32);
+    if (strchr(castle,'q') && board[A8]->type==BROOK) gflags &= ~(8|16);
+  } else {
+    gflags |= 128; /* BHasCastled */
+  }
+  /* en passant square only behind an enemy pawn that has just made a double step */
+  EnPassantSq=0;
+  if (ep[0]>='a' && ep[0]<='h' && ep[1]==((stm=='w') ? '6' : '3')) {
+    int sq = 10*(ep[1]-'1') + ep[0]-'a' + 21, fwd = (stm=='w') ? -10 : 10;
+    if (board[sq]->type==0 && board[sq-fwd]->type==0 && board[sq+fwd]->type==((stm=='w') ? BPAWN : WPAWN))
+      EnPassantSq = sq;
+  }
+  if ((stm=='w') ? BlackKingInCheck() : WhiteKingInCheck()) { /* side not to move in check */
+    RestoreBoard(&saved);
+    return 0;
+  }
+  *colorP = (stm=='w') ? white : black;
+  /* Move Stack Pointers reset */
+  cst_p=0;
+  mv_stack_p=0;
+  HalfMovesPlayed=0;
+  CurrentLine[0] = '\0';
+  LoneKingReachedEdge=0;
+  FiftyMoves = (n >= 4 && halfmoves > 0) ? halfmoves : 0;
+  StartMoveNumber = (n >= 5 && fullmoves > 0) ? fullmoves : 1;
+  StartColor = *colorP;
+  NotStartingPosition=1;
+  PlayerMove.u=0;
+  return 1;
+}
+
+char *WriteFEN(char *buf, int color)
+{
+  /* FEN of the current position, color is the side to move */
+  int rank, file, empty, ptype;
+  char *cp = buf;
+  for (rank=7; rank>=0; rank--) {
+    empty = 0;
+    for (file=0; file<8; file++) {
+      ptype = board[board64[8*rank + file]]->type;
+      if (ptype==0) {
+        empty++;
+        continue;
+      }
+      if (empty) {
+        *cp++ = '0' + empty;
+        empty = 0;
+      }
+      *cp++ = FenPieceChar[ptype];
+    }
+    if (empty)
+      *cp++ = '0' + empty;
+    if (rank)
+      *cp++ = '/';
+  }
+  *cp++ = ' ';
+  *cp++ = (color==white) ? 'w' : 'b';
+  *cp++ = ' ';
+  if (!(gflags & (1|4)) && board[H1]->type==WROOK) *cp++ = 'K';
+  if (!(gflags & (1|2)) && board[A1]->type==WROOK) *cp++ = 'Q';
+  if (!(gflags & (8|32)) && board[H8]->type==BROOK) *cp++ = 'k';
+  if (!(gflags & (8|16)) && board[A8]->type==BROOK) *cp++ = 'q';
+  if (cp[-1]==' ')
+    *cp++ = '-';
+  *cp++ = ' ';
+  if (EnPassantSq) {
+    *cp++ = 'a' + (EnPassantSq%10 - 1);
+    *cp++ = '1' + (EnPassantSq/10 - 2);
+  } else {
+    *cp++ = '-';
+  }
+  sprintf(cp, " %d %d", FiftyMoves, StartMoveNumber + (mv_stack_p + (StartColor==black))/2);
+  return buf;
+}
+
+void CheckSpecialDrawRules(void)
+{
+  int e, IsMaterialEnough;
+  e = StaticEval(&IsMaterialEnough);
+  if (IsMaterialEnough==0) {
+    printf("1/2-1/2 {Draw. Not enough material.}\n");
+  } else  if (HashRepetitions() == 3) {
+    printf("1/2-1/2 {Draw by repetition}\n");
+  } else if (FiftyMoves>=100) {
+    printf("1/2-1/2 {Draw by fifty moves rule}\n");
+  }
+}
+
+void CheckForMate(void)
+{
+  MOVE xmoves[MAXMV];
+  int i, n, actual=0;
+  if (side==white) {
+    n=FindAllWhiteMoves(xmoves);
+    for (i=0; i<n; i++) {
+      PushStatus();
+      MakeMove(&xmoves[i]);
+      if (WhiteKingInCheck()) { RetractLastMove(); PopStatus(); continue; }
+      RetractLastMove(); PopStatus();
+      actual++;
+      break;
+    }
+    if (actual==0) {
+      if (WhiteKingInCheck()) {
+        printf("0-1 {Black Checkmates}\n");
+      } else {
+        printf("1/2-1/2 {Stalemate}\n");
+      }
+    }
+  } else {
+    n=FindAllBlackMoves(xmoves);
+    for (i=0; i<n; i++) {
+      PushStatus();
+      MakeMove(&xmoves[i]);
+      if (BlackKingInCheck()) { RetractLastMove(); PopStatus(); continue; }
+      RetractLastMove();
+      PopStatus();
+      actual++;
+      break;
+    }
+    if (actual==0) {
+      if (BlackKingInCheck()) {
+        printf("1-0 {White Checkmates}\n");
+      } else {
+        printf("1/2-1/2 {Stalemate}\n");
+      }
+    }
+  }
+}
+
+#define AVERAGE_MOVE_NO 40
+
+void SetMaxDepth(int d)
+{
+  if (d <= 0 || d > MAX_DEPTH) {
+    d = MAX_DEPTH;
+  } else if (d < START_DEPTH) { /* iterative deepening always completes START_DEPTH */
+    d = START_DEPTH;
+  }
+  max_depth = d;
+}
+
+void SetExactTime(int secs)
+{
+  if (secs > 0) {
+    max_time = secs*1000LL;
+    exact_time = 1;
+  } else {
+    exact_time = 0;
+  }
+}
+
+void xboard(void)
+{
+  char line[256], command[256];
+  int moveNo=AVERAGE_MOVE_NO, TimeMins, Incr;
+  int x_start_ply, protover;
+  MOVE amove;
+  side=white;
+  ComputerSide=none;   /* no engine at start */
+  if (!exact_time)
+    max_time = 15000; /* by default 15 seconds/move */
   signal(SIGINT, SIG_IGN);
   printf("\n");
   for (;;) {
     fflush(stdout);
     if (side == ComputerSide) {
-      if (side==white) {
-        if (!GetWhiteBestMove(&amove)) {
-          ComputerSide=none;
-          continue;
-        }
-      } else {
-        if (!GetBlackBestMove(&amove)) {
-          ComputerSide=none;
-          continue;
-        }
+      if (!NGSearch(Engine, NULL, NULL, NULL)) {
+        ComputerSide=none;
+        continue;
       }
+      amove.u = Engine->best.u;
       printf("move %s\n",TranslateMoves(&amove));
       UpdateSpecialConditions(&amove);
       PushStatus();
@@ -7511,6 +8542,9 @@ void xboard(void)
     }
     if (!strcmp(command, "time")) {
       int l_move_p;
+      if (exact_time) { /* "st" given: the clock does not change the time per move */
+        continue;
+      }
       if (ComputerSide==white) {
         l_move_p = mv_stack_p+1;
       } else if (ComputerSide==black) {
@@ -7553,6 +8587,7 @@ void xboard(void)
       continue;
     }
     if (!strcmp(command, "level")) {
+      exact_time = 0;
       sscanf(line, "level %d %d %d", &moveNo, &TimeMins, &Incr);
       if (moveNo!=0) {
         max_time = TimeMins*60000/moveNo;
@@ -7565,16 +8600,29 @@ void xboard(void)
       }
       continue;
     }
+    if (!strcmp(command, "st")) {
+      SetExactTime(atoi(line+3));
+      continue;
+    }
+    if (!strcmp(command, "sd")) {
+      SetMaxDepth(atoi(line+3));
+      continue;
+    }
+    if (!strcmp(command, "nodes")) { /* engine specific: fixed nodes per move, 0 = no limit */
+      max_nodes = strtoull(line+6, NULL, 10);
+      continue;
+    }
+    if (!strcmp(command, "seed")) { /* engine specific: deterministic mode with the given seed */
+      if (SharedHashName)
+        printf("Error (not with shared hash tables): %s\n", command);
+      else
+        SetSeed(strtoull(line+5, NULL, 10));
+      continue;
+    }
     if (!strcmp(command, "hint")) {
-      MOVE amove;
-      if (side==white) {
-        if (!GetWhiteBestMove(&amove))
-          continue;
-      } else {
-        if (!GetBlackBestMove(&amove))
-          continue;
-      }
-      printf("Hint: %s\n",TranslateMoves(&amove));
+      if (!NGSearch(Engine, NULL, NULL, NULL))
+        continue;
+      printf("Hint: %s\n", NGResult(Engine)->bestmove);
       continue;
     }
     if (!strcmp(command, "undo")) {
@@ -7596,9 +8644,17 @@ void xboard(void)
       ReadXboardPosition();
       continue;
     }
+    if (!strcmp(command, "setboard")) {
+      if (NGSetPosition(Engine, line+8, NULL)) {
+        x_start_ply=mv_stack_p;
+      } else {
+        printf("tellusererror Illegal position\n");
+      }
+      continue;
+    }
     if (!strcmp(command, "protover")) {
       sscanf(line, "protover %d", &protover);
-      printf("feature nps=0 sigint=0 draw=0 analyze=0 time=1 ping=1 done=1\n");
+      printf("feature nps=0 sigint=0 draw=0 analyze=0 time=1 ping=1 setboard=1 done=1\n");
       continue;
     }
     if (!strcmp(command, "ping")) {
@@ -7629,94 +8685,2463 @@ void xboard(void)
   }
 }
 
-void Printmenu()
+/* ------------------------- BENCHMARK ------------------------------------------ */
+
+#define BENCH_DEPTH 8
+
+const char *BenchPositions[] = {
+  "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10",
+  "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+  "rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
+  "r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
+  "r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - - 2 15",
+  "r1bbk1nr/pp3p1p/2n5/1N4p1/2Np1B2/8/PPP2PPP/2KR1B1R w kq - 0 13",
+  "r1bq1rk1/ppp1nppp/4n3/3p3Q/3P4/1BP1B3/PP1N2PP/R4RK1 w - - 1 16",
+  "4r1k1/r1q2ppp/ppp2n2/4P3/5Rb1/1N1BQ3/PPP3PP/R5K1 w - - 1 17",
+  "2rqkb1r/ppp2p2/2npb1p1/1N1Nn2p/2P1PP2/8/PP2B1PP/R1BQK2R b KQ - 0 11",
+  "r1bq1r1k/b1p1npp1/p2p3p/1p6/3PP3/1B2NN2/PP3PPP/R2Q1RK1 w - - 1 16",
+  "3r1rk1/p5pp/bpp1pp2/8/q1PP1P2/b3P3/P2NQRPP/1R2B1K1 b - - 6 22",
+  "r1q2rk1/2p1bppp/2Pp4/p6b/Q1PNp3/4B3/PP1R1PPP/2K4R w - - 2 18",
+  "4k2r/1pb2ppp/1p2p3/1R1p4/3P4/2r1PN2/P4PPP/1R4K1 b - - 3 22",
+  "3q2k1/pb3p1p/4pbp1/2r5/PpN2N2/1P2P2P/5PP1/Q2R2K1 b - - 4 26",
+  "6k1/3b3r/1p1p4/p1n2p2/1PPNpP1q/P3Q1p1/1R1RB1P1/5K2 b - - 0 1",
+  "r2r1n2/pp2bk2/2p1p2p/3q4/3PN1QP/2P3R1/P4PP1/5RK1 w - - 0 1",
+  "r1bqkbnr/pppp1ppp/2n5/1B2p3/4P3/5N2/PPPP1PPP/RNBQK2R b KQkq - 3 3",
+  "rnbqkb1r/pppppppp/5n2/8/2PP4/8/PP2PPPP/RNBQKBNR b KQkq c3 0 2",
+  "r1bqk2r/pp2bppp/2n1pn2/2pp4/3P4/2PBPN2/PP1N1PPP/R1BQK2R w KQkq - 0 7",
+  "r2q1rk1/pb1nbppp/1p2pn2/2pp4/2PP4/1PN1PN2/PB2BPPP/R2Q1RK1 w - - 2 10",
+  "1r3k2/4q3/2Pp3b/3Bp3/2Q2p2/1p1P2P1/1P2KP2/3N4 w - - 0 1",
+  "6k1/4pp1p/3p2p1/P1pPb3/R7/1r2P1PP/3B1P2/6K1 w - - 0 1",
+  "6k1/6p1/P6p/r1N5/5p2/7P/1b3PP1/4R1K1 w - - 0 1",
+  "8/pp2r1k1/2p1p3/3pP2p/1P1P1P1P/P5KR/8/8 w - - 0 1",
+  "6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/3N4 b - - 0 1",
+  "3b4/5kp1/1p1p1p1p/pP1PpP1P/P1P1P3/3KN3/8/8 w - - 0 1",
+  "8/3p4/p1bk3p/Pp6/1Kp1PpPp/2P2P1P/2P5/5B2 b - - 0 1",
+  "8/3p3B/5p2/5P2/p7/PP5b/k7/6K1 w - - 0 1",
+  "8/6pk/1p6/8/PP3p1p/5P2/4KP1q/3Q4 w - - 0 1",
+  "7k/3p2pp/4q3/8/4Q3/5Kp1/P6b/8 w - - 0 1",
+  "8/R7/2q5/8/6k1/8/1P5p/K6R w - - 0 124",
+  "5k2/7R/4P2p/5K2/p1r2P1p/8/8/8 b - - 0 1",
+  "2K5/p7/7P/5pR1/8/5k2/r7/8 w - - 0 1",
+  "8/2p4P/8/kr6/6R1/8/8/1K6 w - - 0 1",
+  "8/8/1P6/5pr1/8/4R3/7k/2K5 w - - 0 1",
+  "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 11",
+  "8/2p5/8/2kPKp1p/2p4P/2P5/3P4/8 w - - 0 1",
+  "8/1p3pp1/7p/5P1P/2k3P1/8/2K2P2/8 w - - 0 1",
+  "8/8/3P3k/8/1p6/8/1P6/1K3n2 b - - 0 1",
+  "8/8/8/8/5kp1/P7/8/1K1N4 w - - 0 1",
+  "8/8/8/5N2/8/p7/8/2NK3k w - - 0 1",
+  "8/3k4/8/8/8/4B3/4KB2/2B5 w - - 0 1"
+};
+
+void Bench(int depth)
 {
-  fprintf(stderr,"xboard - switch to XBoard mode\n");
-  fprintf(stderr,"play   - Play using Native console\n");
-  fprintf(stderr,"perft  - Performance test. (used also for Move Generation check) \n");
-  fprintf(stderr,"help   - displays a list of commands.\n");
-  fprintf(stderr,"bye    - exit the program\n");
-}
+  /* Fixed depth search of the embedded positions, from empty tables each time.
+     Node count and signature change only when search behaviour changes. */
+  int i, color, nPositions = sizeof(BenchPositions)/sizeof(BenchPositions[0]);
+  int SavedOutput=Xoutput, SavedDepth=max_depth, SavedExact=exact_time, SavedDeterministic=Deterministic;
+  long long int SavedTime=max_time, SearchStart, elapsed=0;
+  unsigned long long SavedNodes=max_nodes, TotalNodes=0, signature=14695981039346656037ULL;
+  MOVE amove;
 
-/* -------  Main Function for NGplay Chess Engine -------- */
+  if (SharedHashName) { /* what other processes leave in the tables changes every search */
+    printf("bench needs hash tables of its own, it cannot run with -m\n");
+    return;
+  }
+  if (depth <= 0)
+    depth = BENCH_DEPTH;
+  SetMaxDepth(depth);
+  max_time = 24LL*3600*1000;
+  max_nodes = 0;
+  exact_time = 0;
+  Deterministic = 0;
+  for (i=0; i<nPositions; i++) {
+    if (!ReadFEN(BenchPositions[i], &color)) {
+      printf("Bad bench position %d\n", i+1);
+      continue;
+    }
+    ClearHashTables();
+    ResetHistory();
+    GlobalPV.cmove = 0;
+    ngmax = PrevNgmax = -INFINITY_;
+    amove.u = 0;
+    Xoutput = 0;
+    SearchStart = GetMillisecs(); /* table clearing is not timed */
+    GetBestMove(&amove, color);
+    elapsed += GetMillisecs() - SearchStart;
+    Xoutput = SavedOutput;
+    TotalNodes += g_nodes;
+    signature = (signature ^ g_nodes) * 1099511628211ULL;
+    signature = (signature ^ amove.u) * 1099511628211ULL;
+    signature = (signature ^ (unsigned long long)(ngmax & 0xffff)) * 1099511628211ULL;
+    printf("%2d/%d %-6s %6d %12llu  %s\n", i+1, nPositions, TranslateMoves(&amove), ngmax, g_nodes, BenchPositions[i]);
+    fflush(stdout);
+  }
+  if (elapsed <= 0)
+    elapsed = 1;
+  printf("\n===========================\n");
+  printf("Depth          : %d\n", max_depth);
+  printf("Total time (ms): %lld\n", elapsed);
+  printf("Nodes searched : %llu\n", TotalNodes);
+  printf("Nodes/second   : %llu\n", TotalNodes*1000ULL/(unsigned long long)elapsed);
+  printf("Signature      : %016llx\n", signature);
+  fflush(stdout);
+
+  max_depth = SavedDepth;
+  max_time = SavedTime;
+  max_nodes = SavedNodes;
+  exact_time = SavedExact;
+  Deterministic = SavedDeterministic;
+  StartingPosition();
+}
 
-int main(int argc, char **argv)
+int LegalMoves(MOVE mlst[], int color)
 {
-  char s[256], book_s[256];
-  Init_Pawn_Eval();
-  printf("\n");
-  MAX_TT  = 0x7fffff;
-  PMAX_TT = (MAX_TT+1)/2-1;
-  InitHash();
-  strcpy(book_s,"NG3book.txt");
-  StartingPosition();
-  printf("\n--  %s Chess Engine  --\n", argv[0]);
-  printf("Optional Run Time Usage: %s -p<positionFile> -b<BookFile> \n", argv[0]);
-  if (argc>1) {
-     int i;
-     for (i=1; i<argc; i++) {
-       if (argv[i][0]=='-' && argv[i][1]=='b') {
-         strcpy(book_s, &(argv[1][2]));
-       } 
-       else if (argv[i][0]=='-' && argv[i][1]=='p') {
-         ReadPosition(&(argv[1][2]));
-       }
-       else if (argv[i][0]=='-' && argv[i][1]=='h') {
-       }
-     }
-  } 
-  T_T = (struct tt_st *) calloc(MAX_TT+CLUSTER_SIZE, sizeof(struct tt_st));
-  if (T_T==NULL) {
-    printf("\nUnable to allocate Hash Table. Exiting.\n");
-    exit(1);
-  }
-  Opp_T_T = (struct tt_st *) calloc(MAX_TT+CLUSTER_SIZE, sizeof(struct tt_st));
-  if (Opp_T_T==NULL) {
-    printf("\nUnable to allocate Hash Table. Exiting.\n");
-    exit(1);
+  int i, n, actual=0;
+  n = (color==white) ? FindAllWhiteMoves(mlst) : FindAllBlackMoves(mlst);
+  for (i=0; i<n; i++) {
+    PushStatus();
+    MakeMove(&mlst[i]);
+    if ((color==white) ? WhiteKingInCheck() : BlackKingInCheck()) {
+      RetractLastMove(); PopStatus();
+      continue;
+    }
+    RetractLastMove(); PopStatus();
+    mlst[actual++] = mlst[i];
   }
-  P_T_T = (struct ptt_st *) calloc(PMAX_TT+1, sizeof(struct ptt_st));
-  if (P_T_T==NULL) {
-    printf("\nUnable to allocate Pawn Hash Table. Exiting.\n");
-    exit(1);
+  return actual;
+}
+
+int ParseSAN(const char *san, MOVE *mp, int color)
+{
+  /* Standard algebraic (Nbd7, exd5, e8=Q+, O-O) or coordinate (e2e4) notation.
+     Returns 1 when exactly one legal move matches */
+  char buf[16];
+  int len, i, n, found=0, piece=WPAWN, promo=0, from, to, FromFile=-1, FromRank=-1, kind, ptype;
+  MOVE mlst[MAXMV];
+  strncpy(buf, san, 15);
+  buf[15] = '\0';
+  len = strlen(buf);
+  while (len > 0 && strchr("+#!?", buf[len-1]))
+    buf[--len] = '\0';
+  n = LegalMoves(mlst, color);
+  if (!strcmp(buf, "O-O") || !strcmp(buf, "0-0") || !strcmp(buf, "O-O-O") || !strcmp(buf, "0-0-0")) {
+    int from = (color==white) ? E1 : E8;
+    to = from + ((len==3) ? 2 : -2);
+    for (i=0; i<n; i++) {
+      if (mlst[i].m.from==from && mlst[i].m.to==to && board[from]->type==((color==white) ? WKING : BKING)) {
+        *mp = mlst[i];
+        return 1;
+      }
+    }
+    return 0;
   }
-  #ifdef DBGHASH
-  printf("\n%u MBytes allocated for Hash Tables. Hash location size=%d bytes.\n\n",
-         (unsigned int)(2*(MAX_TT+CLUSTER_SIZE)*sizeof(struct tt_st)/MByte), sizeof(struct tt_st));
-  printf("\n%u MBytes allocated for Pawn Hash Tables. Hash location size=%d bytes.\n\n",
-         (unsigned int)((PMAX_TT+1)*sizeof(struct ptt_st)/MByte), sizeof(struct ptt_st));
-  #else
-  printf("\nMemory allocated for Hash Tables.\n\n");
-  #endif
-  book_file = fopen(book_s, "r");
-   if (!book_file)
-     fprintf(stderr,"Opening book missing.\n");
-  printf("Commands available:\n\n");
-  Printmenu();
-  printf("\n");
-  for (;;) {
-    /* get user input */
-    fprintf(stderr,"> ");
-    if (scanf("%s", s) == EOF)
+  if (len >= 4 && buf[0]>='a' && buf[0]<='h' && buf[1]>='1' && buf[1]<='8' &&
+                  buf[2]>='a' && buf[2]<='h' && buf[3]>='1' && buf[3]<='8') { /* coordinate notation */
+    FromFile = buf[0]-'a';
+    FromRank = buf[1]-'1';
+    memmove(buf, buf+2, len-1);
+    len -= 2;
+  }
+  if (len > 0 && strchr("NBRQ", buf[len-1]) && len >= 3) { /* promotion, with or without '=' */
+    promo = WKNIGHT + (int)(strchr("NBRQ", buf[len-1]) - "NBRQ");
+    buf[--len] = '\0';
+    if (len > 0 && buf[len-1]=='=')
+      buf[--len] = '\0';
+  } else if (len > 0 && strchr("nbrq", buf[len-1]) && FromFile >= 0) {
+    promo = WKNIGHT + (int)(strchr("nbrq", buf[len-1]) - "nbrq");
+    buf[--len] = '\0';
+  }
+  if (len < 2 || buf[len-2]<'a' || buf[len-2]>'h' || buf[len-1]<'1' || buf[len-1]>'8')
+    return 0;
+  to = 10*(buf[len-1]-'1') + buf[len-2]-'a' + 21;
+  buf[len-2] = '\0';
+  for (i=0; buf[i]; i++) {
+    if (strchr("KQRBN", buf[i]) && i==0) {
+      piece = WKNIGHT + (int)(strchr("NBRQK", buf[i]) - "NBRQK");
+    } else if (buf[i]>='a' && buf[i]<='h') {
+      FromFile = buf[i]-'a';
+    } else if (buf[i]>='1' && buf[i]<='8') {
+      FromRank = buf[i]-'1';
+    } else if (buf[i]!='x' && buf[i]!='-' && buf[i]!=':') {
       return 0;
-    if (!strcmp(s, "bye")) {
-      printf("Have a nice day!\n");
-      break;
     }
-    if (!strcmp(s, "xboard")) {
-      Xoutput = _XBOARD_OUTPUT;
-      xboard();
-      break;
+  }
+  for (i=0; i<n; i++) {
+    if (mlst[i].m.to!=to)
+      continue;
+    from = mlst[i].m.from;
+    ptype = board[from]->type;
+    kind = (ptype > black) ? ptype - (BPAWN-WPAWN) : ptype;
+    if (FromFile >= 0 && (from%10 - 1) != FromFile)
+      continue;
+    if (FromRank >= 0 && (from/10 - 2) != FromRank)
+      continue;
+    if (FromFile < 0 || FromRank < 0 || piece != WPAWN) { /* piece letter must match in SAN */
+      if (kind != piece)
+        continue;
     }
-    if (!strcmp(s, "play")) {
-      Xoutput = _NORMAL_OUTPUT;
-      ShowBoard();
-      do {
-        fprintf(stderr,"\nGive Computer Side (White = 1, Black = 2, None = 3) : ");
-        scanf("%d",&ComputerSide);
-      } while ((ComputerSide!=1) && (ComputerSide!=2) && (ComputerSide!=3));
-      if (ComputerSide==2) ComputerSide=black;
-      if (ComputerSide!=3) {
+    if (kind==WPAWN && (to<=H1 || to>=A8)) { /* promotion, queen if not given */
+      int pflag = ((promo) ? promo : WQUEEN) + ((color==black) ? (BPAWN-WPAWN) : 0);
+      if (mlst[i].m.flag != pflag)
+        continue;
+    }
+    *mp = mlst[i];
+    found++;
+  }
+  return (found==1);
+}
+
+void RunEPD(const char *fname, int secs)
+{
+  /* Search every EPD position with the current node limit, else secs per position,
+     and report when the bm (or a non am) move was found */
+  FILE *fp;
+  char line[1024], fen[4*100], ops[1024], id[64], *cp;
+  int color, nPositions=0, nSolved=0, nErrors=0, k, missing;
+  int SavedOutput=Xoutput, SavedExact=exact_time;
+  long long int SavedTime=max_time, SearchStart, elapsed, TotalTime=0, SolvedTimeSum=0;
+  unsigned long long TotalNodes=0;
+  MOVE amove;
+
+  if (SharedHashName) { /* each position starts from empty tables */
+    printf("epd needs hash tables of its own, it cannot run with -m\n");
+    return;
+  }
+  if ((fp=fopen(fname,"r"))==NULL) {
+    fprintf(stderr,"Cannot open EPD file %s\n", fname);
+    return;
+  }
+  if (!max_nodes)
+    SetExactTime((secs > 0) ? secs : EPD_SECS);
+  while (fgets(line, 1024, fp) != NULL) {
+    char f[4][100];
+    int nf = sscanf(line, "%99s %99s %99s %99s%1023[^\n]", f[0], f[1], f[2], f[3], ops);
+    if (nf < 4)
+      continue;
+    if (nf < 5)
+      ops[0] = '\0';
+    sprintf(fen, "%s %s %s %s", f[0], f[1], f[2], f[3]);
+    nPositions++;
+    if (!ReadFEN(fen, &color)) {
+      printf("%4d illegal position: %s\n", nPositions, fen);
+      nErrors++;
+      continue;
+    }
+    id[0] = '\0';
+    if ((cp = strstr(ops, "id \"")) != NULL) {
+      sscanf(cp+4, "%63[^\"]", id);
+    }
+    Epd.nbm = Epd.nam = 0;
+    missing = 0;
+    for (k=0; k<2; k++) { /* bm then am operations: moves up to ';' */
+      char *op = strstr(ops, (k==0) ? "bm " : "am ");
+      char movebuf[16];
+      int used;
+      if (op==NULL)
+        continue;
+      missing |= 1 << k; /* cleared by the first move that parses */
+      op += 3;
+      while (sscanf(op, " %15[^ ;]%n", movebuf, &used) == 1) {
+        MOVE m;
+        if (ParseSAN(movebuf, &m, color)) {
+          if (k==0 && Epd.nbm < EPD_MAX_MOVES) Epd.bm[Epd.nbm++] = m;
+          if (k==1 && Epd.nam < EPD_MAX_MOVES) Epd.am[Epd.nam++] = m;
+          missing &= ~(1 << k);
+        } else {
+          printf("%4d cannot parse move %s\n", nPositions, movebuf);
+        }
+        op += used;
+        if (*op==';')
+          break;
+      }
+    }
+    if (missing) { /* an operation without a usable move cannot be scored */
+      printf("%4d %-16s error: no %s move could be parsed\n", nPositions, id, (missing & 1) ? "bm" : "am");
+      nErrors++;
+      continue;
+    }
+    if (Epd.nbm==0 && Epd.nam==0) { /* nothing to solve */
+      printf("%4d %-16s error: no bm or am operation\n", nPositions, id);
+      nErrors++;
+      continue;
+    }
+    ClearHashTables();
+    ResetHistory();
+    GlobalPV.cmove = 0;
+    ngmax = PrevNgmax = -INFINITY_;
+    amove.u = 0;
+    Epd.SolvedDepth = -1;
+    Epd.active = 1;
+    Xoutput = 0;
+    SearchStart = GetMillisecs();
+    GetBestMove(&amove, color);
+    elapsed = GetMillisecs() - SearchStart;
+    Xoutput = SavedOutput;
+    Epd.active = 0;
+    if (!EpdMoveSolves(&amove)) {
+      Epd.SolvedDepth = -1;
+    } else if (Epd.SolvedDepth < 0) { /* no completed iteration: book or single reply */
+      Epd.SolvedDepth = 0;
+      Epd.SolvedTime = elapsed;
+      Epd.SolvedNodes = g_nodes;
+    }
+    TotalTime += elapsed;
+    TotalNodes += g_nodes;
+    if (Epd.SolvedDepth >= 0) {
+      nSolved++;
+      SolvedTimeSum += Epd.SolvedTime;
+      printf("%4d %-16s %-6s solved   time %6lld ms  depth %2d  nodes %llu\n", nPositions, id,
+             TranslateMoves(&amove), Epd.SolvedTime, Epd.SolvedDepth, Epd.SolvedNodes);
+    } else {
+      printf("%4d %-16s %-6s failed\n", nPositions, id, TranslateMoves(&amove));
+    }
+    fflush(stdout);
+  }
+  fclose(fp);
+  if (TotalTime <= 0)
+    TotalTime = 1;
+  printf("\n===========================\n");
+  printf("Solved         : %d / %d\n", nSolved, nPositions - nErrors);
+  if (nErrors)
+    printf("Errors         : %d (not counted)\n", nErrors);
+  printf("Avg solve time : %lld ms\n", nSolved ? SolvedTimeSum/nSolved : 0LL);
+  printf("Total time (ms): %lld\n", TotalTime);
+  printf("Nodes searched : %llu\n", TotalNodes);
+  printf("Nodes/second   : %llu\n", TotalNodes*1000ULL/(unsigned long long)TotalTime);
+  fflush(stdout);
+  max_time = SavedTime;
+  exact_time = SavedExact;
+  StartingPosition();
+}
+
+/* ----------------------- BATCH ANALYSIS ---------------------------------------- */
+/* Tasks (a FEN, or a whole PGN game flattened to one line) are handed to a pool
+   of worker processes. Every worker owns a full copy of the engine state and its
+   share of the hash tables, so the search code needs no locking. Results are
+   streamed as each task completes, tagged with the task number. */
+
+#define BATCH_SECS        1     /* default time per position */
+#define BATCH_MAX_WORKERS 64
+#define BATCH_LINE        4000  /* one output line fits an atomic pipe write */
+#define BATCH_TASK        65536
+#define BATCH_CSV         0
+#define BATCH_JSON        1
+#define BATCH_PGN         2
+
+int BatchResultFd=-1, BatchWorkerId=0;
+char *BatchCapture=NULL; /* output of the task in progress, when the caller collects it */
+size_t BatchCaptureLen=0;
+
+typedef int (*BATCH_READER)(FILE *fp, char *task);
+typedef void (*BATCH_JOB)(int index, char *task, int format);
+typedef int (*BATCH_DONE)(const char *result); /* gets a task's output, nonzero stops dispatching */
+
+void AppendText(char **bufP, size_t *lenP, const char *text)
+{
+  size_t len = strlen(text);
+  *bufP = (char *) realloc(*bufP, *lenP+len+1);
+  memcpy(*bufP + *lenP, text, len+1);
+  *lenP += len;
+}
+
+void BatchOutput(const char *text)
+{
+  /* In a worker every line goes to the parent as "id line", else straight to stdout */
+  if (BatchResultFd >= 0) {
+    char buf[BATCH_LINE+16];
+    while (*text) {
+      int n = strcspn(text, "\n");
+      int len = sprintf(buf, "%d %.*s\n", BatchWorkerId, (n < BATCH_LINE) ? n : BATCH_LINE, text);
+      write(BatchResultFd, buf, len);
+      text += n;
+      if (*text=='\n')
+        text++;
+    }
+  } else if (BatchCapture) {
+    AppendText(&BatchCapture, &BatchCaptureLen, text);
+  } else {
+    fputs(text, stdout);
+  }
+}
+
+int NextBatchLine(FILE *fp, char *task)
+{
+  /* one FEN per line, blank and comment lines skipped */
+  while (fgets(task, BATCH_LINE, fp) != NULL) {
+    char *cp = task + strspn(task, " \t");
+    if (*cp != '\0' && *cp != '\n' && *cp != '\r' && *cp != '#') {
+      task[strcspn(task, "\r\n")] = '\0';
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void AnalyseFEN(int index, char *fen, int format)
+{
+  /* Search one position under the current limits and print the result line */
+  int color, i, len;
+  long long int SearchStart, elapsed;
+  char pv[BATCH_LINE/2], out[BATCH_LINE];
+  MOVE amove;
+  if (!ReadFEN(fen, &color)) {
+    if (format==BATCH_JSON)
+      sprintf(out, "{\"index\":%d,\"fen\":\"%.100s\",\"error\":\"illegal position\"}\n", index, fen);
+    else
+      sprintf(out, "%d,\"%.100s\",,,,,,\"illegal position\"\n", index, fen);
+    BatchOutput(out);
+    return;
+  }
+  ClearHashTables();
+  ResetHistory();
+  GlobalPV.cmove = 0;
+  ngmax = PrevNgmax = -INFINITY_;
+  amove.u = 0;
+  SearchStart = GetMillisecs();
+  GetBestMove(&amove, color);
+  elapsed = GetMillisecs() - SearchStart;
+  len = 0;
+  pv[0] = '\0';
+  for (i=0; i<GlobalPV.cmove && len < (int)sizeof(pv)-8; i++)
+    len += sprintf(pv+len, (i) ? " %s" : "%s", TranslateMoves(&GlobalPV.argmove[i]));
+  if (format==BATCH_JSON)
+    sprintf(out, "{\"index\":%d,\"fen\":\"%.100s\",\"bestmove\":\"%s\",\"score\":%d,\"depth\":%d,"
+            "\"nodes\":%llu,\"time\":%lld,\"pv\":\"%s\"}\n", index, fen, (amove.u) ? TranslateMoves(&amove) : "",
+            ngmax, CompletedDepth, g_nodes, elapsed, pv);
+  else
+    sprintf(out, "%d,\"%.100s\",%s,%d,%d,%llu,%lld,\"%s\"\n", index, fen, (amove.u) ? TranslateMoves(&amove) : "",
+            ngmax, CompletedDepth, g_nodes, elapsed, pv);
+  BatchOutput(out);
+}
+
+#ifndef _WIN32
+void BatchWorker(int TaskFd, BATCH_JOB job, int format)
+{
+  /* Tasks arrive as "index task\n". A bare "id\n" tells the parent the task is done */
+  static char task[BATCH_TASK+16];
+  FILE *tasks = fdopen(TaskFd, "r");
+  char done[16];
+  int index, used, len;
+  while (fgets(task, sizeof(task), tasks) != NULL) {
+    if (sscanf(task, "%d %n", &index, &used) < 1)
+      continue;
+    task[strcspn(task, "\n")] = '\0';
+    job(index, task+used, format);
+    len = sprintf(done, "%d\n", BatchWorkerId);
+    if (write(BatchResultFd, done, len) != len)
+      break;
+  }
+  fclose(tasks);
+}
+
+int SendBatchTask(int fd, int index, const char *task)
+{
+  char head[16];
+  int len = sprintf(head, "%d ", index);
+  return (write(fd, head, len)==len && write(fd, task, strlen(task))==(int)strlen(task) && write(fd, "\n", 1)==1);
+}
+
+char **BatchReady=NULL; /* outputs of finished tasks waiting for an earlier one, by index */
+int BatchReadySize=0, BatchNextOut=1;
+
+void BatchInOrder(int index, char *text)
+{
+  /* Takes over the malloc'd output of a finished task and prints all that is now in turn */
+  if (index >= BatchReadySize) {
+    int size = 2*index + 16;
+    BatchReady = (char **) realloc(BatchReady, size*sizeof(char *));
+    memset(BatchReady + BatchReadySize, 0, (size-BatchReadySize)*sizeof(char *));
+    BatchReadySize = size;
+  }
+  BatchReady[index] = (text) ? text : strdup("");
+  while (BatchNextOut < BatchReadySize && BatchReady[BatchNextOut]) {
+    fputs(BatchReady[BatchNextOut], stdout);
+    free(BatchReady[BatchNextOut]);
+    BatchReady[BatchNextOut++] = NULL;
+  }
+  fflush(stdout);
+}
+
+int BatchTaskLost(int index, int worker, BATCH_DONE done, int format)
+{
+  /* The error line for a task whose worker died before finishing it */
+  char out[128];
+  int stop=0;
+  if (done) {
+    sprintf(out, "#error task %d lost, worker %d died\n", index, worker);
+    stop = done(out);
+  } else {
+    if (format==BATCH_JSON)
+      sprintf(out, "{\"index\":%d,\"error\":\"worker died\"}\n", index);
+    else if (format==BATCH_PGN)
+      sprintf(out, "{task %d lost, worker died} *\n\n", index);
+    else
+      sprintf(out, "%d,,,,,,,\"worker died\"\n", index);
+    BatchInOrder(index, strdup(out));
+  }
+  fflush(stdout);
+  return stop;
+}
+#endif
+
+void RunBatch(FILE *fp, BATCH_READER reader, BATCH_JOB job, BATCH_DONE done, int workers, int format)
+{
+  static char task[BATCH_TASK];
+  int index=0, SavedOutput=Xoutput, stop=0;
+  if (!max_nodes && !exact_time && max_depth==MAX_DEPTH)
+    SetExactTime(BATCH_SECS);
+  fflush(stdout);
+  Xoutput = 0;
+  #ifndef _WIN32
+  if (workers > 1) {
+    int TaskFd[BATCH_MAX_WORKERS], Task[BATCH_MAX_WORKERS], ResultPipe[2], i, k, n, running=0, id, len=0, dead=0;
+    char *Pending[BATCH_MAX_WORKERS], results[2*BATCH_LINE+32], *line, *eol;
+    size_t PendingLen[BATCH_MAX_WORKERS];
+    pid_t pids[BATCH_MAX_WORKERS], pid;
+    fd_set fds;
+    struct timeval tv;
+    if (pipe(ResultPipe) != 0) {
+      fprintf(stderr,"Cannot create pipe\n");
+      return;
+    }
+    for (k=0; k<workers; k++) {
+      int TaskPipe[2];
+      if (pipe(TaskPipe) != 0)
+        break;
+      if ((pids[k] = fork()) == 0) {
+        for (i=0; i<k; i++) /* only the parent may hold a worker's task pipe open */
+          close(TaskFd[i]);
+        close(TaskPipe[1]);
+        close(ResultPipe[0]);
+        BatchWorkerId = k;
+        BatchResultFd = ResultPipe[1];
+        BatchWorker(TaskPipe[0], job, format);
+        _exit(0);
+      }
+      close(TaskPipe[0]);
+      TaskFd[k] = TaskPipe[1];
+      Pending[k] = NULL;
+      PendingLen[k] = 0;
+    }
+    workers = k;
+    close(ResultPipe[1]);
+    BatchNextOut = 1;
+    /* one task per worker, then the next task goes to whoever finishes */
+    for (k=0; k<workers; k++) {
+      Task[k] = 0;
+      if (reader(fp, task) && SendBatchTask(TaskFd[k], ++index, task)) {
+        Task[k] = index;
+        running++;
+      } else {
+        close(TaskFd[k]);
+      }
+    }
+    while (running > 0) {
+      /* A worker that dies mid-task never says it is done: once the pipe has run dry
+         after its exit, its task is reported lost instead of waiting for it forever */
+      FD_ZERO(&fds);
+      FD_SET(ResultPipe[0], &fds);
+      tv.tv_sec = (dead) ? 0 : 1;
+      tv.tv_usec = 0;
+      n = select(ResultPipe[0]+1, &fds, NULL, NULL, &tv);
+      if (n < 0)
+        continue;
+      if (n == 0) {
+        for (k=0; k<workers && dead; k++) {
+          if (pids[k] || !Task[k])
+            continue;
+          stop |= BatchTaskLost(Task[k], k, done, format);
+          free(Pending[k]);
+          Pending[k] = NULL;
+          PendingLen[k] = 0;
+          Task[k] = 0;
+          close(TaskFd[k]);
+          running--;
+        }
+        dead = 0;
+        while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+          for (k=0; k<workers; k++) {
+            if (pids[k]==pid) {
+              pids[k] = 0;
+              dead = 1;
+            }
+          }
+        }
+        continue;
+      }
+      if ((n = read(ResultPipe[0], results+len, sizeof(results)-1-len)) <= 0) {
+        for (k=0; k<workers; k++) { /* every worker is gone */
+          if (Task[k])
+            BatchTaskLost(Task[k], k, done, format);
+          free(Pending[k]);
+        }
+        break;
+      }
+      len += n;
+      results[len] = '\0';
+      line = results;
+      while ((eol = strchr(line, '\n')) != NULL) {
+        char *text = line + strspn(line, "0123456789");
+        *eol = '\0';
+        id = atoi(line);
+        line = eol+1;
+        if (id < 0 || id >= workers || !Task[id])
+          continue;
+        if (*text==' ') { /* output of a task in progress, kept until it completes */
+          AppendText(&Pending[id], &PendingLen[id], text+1);
+          AppendText(&Pending[id], &PendingLen[id], "\n");
+          continue;
+        }
+        if (done) {
+          stop |= done((Pending[id]) ? Pending[id] : "");
+          fflush(stdout);
+          free(Pending[id]);
+        } else { /* results come out in input order, whoever finishes first */
+          BatchInOrder(Task[id], Pending[id]);
+        }
+        Pending[id] = NULL;
+        PendingLen[id] = 0;
+        Task[id] = 0;
+        running--;
+        if (!stop && reader(fp, task) && SendBatchTask(TaskFd[id], ++index, task)) {
+          Task[id] = index;
+          running++;
+        } else {
+          close(TaskFd[id]);
+        }
+      }
+      len -= line - results;
+      memmove(results, line, len);
+    }
+    close(ResultPipe[0]);
+    for (k=BatchNextOut; k<BatchReadySize; k++) { /* held back behind a task that never ended */
+      if (BatchReady[k])
+        fputs(BatchReady[k], stdout);
+      free(BatchReady[k]);
+    }
+    free(BatchReady);
+    BatchReady = NULL;
+    BatchReadySize = 0;
+    while (wait(NULL) > 0)
+      ;
+  } else
+  #endif
+  {
+    while (!stop && reader(fp, task)) {
+      if (done) {
+        BatchCapture = (char *) calloc(1, 1);
+        BatchCaptureLen = 0;
+        job(++index, task, format);
+        stop = done(BatchCapture);
+        free(BatchCapture);
+        BatchCapture = NULL;
+      } else {
+        job(++index, task, format);
+      }
+      fflush(stdout);
+    }
+  }
+  Xoutput = SavedOutput;
+}
+
+/* ----------------------- PGN ANNOTATION ---------------------------------------- */
+
+#define PGN_MAX_PLIES (MAX_STACK - MAX_PLY - 16) /* room left on the move stack for the search */
+
+int NextPGNGame(FILE *fp, char *task)
+{
+  /* Tag pairs and movetext of the next game, joined into one line */
+  static char line[BATCH_LINE];
+  static int HaveLine=0;
+  int len=0, InMoves=0, braces=0, n;
+  char *cp;
+  for (;;) {
+    if (!HaveLine && fgets(line, BATCH_LINE, fp)==NULL)
+      break;
+    HaveLine = 0;
+    line[strcspn(line, "\r\n")] = '\0';
+    cp = line + strspn(line, " \t");
+    if (braces==0 && *cp=='\0') {
+      if (InMoves)
+        break;
+      continue;
+    }
+    if (braces==0 && *cp=='%')
+      continue;
+    if (braces==0 && *cp=='[') {
+      if (InMoves) { /* no blank line before the next game */
+        HaveLine = 1;
+        break;
+      }
+    } else {
+      InMoves = 1;
+    }
+    for (; *cp; cp++) { /* ';' comments run to the end of the line */
+      if (*cp=='{') braces++;
+      if (*cp=='}' && braces>0) braces--;
+      if (*cp==';' && braces==0) break;
+      if (len < BATCH_TASK-2)
+        task[len++] = (*cp=='\t') ? ' ' : *cp;
+    }
+    if (len < BATCH_TASK-2)
+      task[len++] = ' ';
+  }
+  task[len] = '\0';
+  n = len;
+  while (n > 0 && task[n-1]==' ')
+    n--;
+  return (n > 0);
+}
+
+void MoveToSAN(MOVE *mp, int color, char *san)
+{
+  /* Standard algebraic notation of a legal move of color */
+  MOVE mlst[MAXMV];
+  int i, n, ptype, kind, from=mp->m.from, to=mp->m.to, len=0, SameFile=0, SameRank=0, others=0;
+  ptype = board[from]->type;
+  kind = (ptype > black) ? ptype - (BPAWN-WPAWN) : ptype;
+  if (kind==WKING && (to-from==2 || from-to==2)) {
+    strcpy(san, (to > from) ? "O-O" : "O-O-O");
+    len = strlen(san);
+  } else {
+    if (kind != WPAWN) {
+      san[len++] = " PNBRQK"[kind-1];
+      n = LegalMoves(mlst, color);
+      for (i=0; i<n; i++) {
+        int xy = mlst[i].m.from;
+        if (mlst[i].m.to != to || xy == from || board[xy]->type != ptype)
+          continue;
+        others++;
+        if (xy%10 == from%10) SameFile=1;
+        if (xy/10 == from/10) SameRank=1;
+      }
+      if (others && !SameFile) {
+        san[len++] = 'a' + from%10 - 1;
+      } else if (others && !SameRank) {
+        san[len++] = '1' + from/10 - 2;
+      } else if (others) {
+        san[len++] = 'a' + from%10 - 1;
+        san[len++] = '1' + from/10 - 2;
+      }
+    }
+    if (board[to]->type > 0 || (kind==WPAWN && from%10 != to%10)) {
+      if (kind==WPAWN)
+        san[len++] = 'a' + from%10 - 1;
+      san[len++] = 'x';
+    }
+    san[len++] = 'a' + to%10 - 1;
+    san[len++] = '1' + to/10 - 2;
+    if (kind==WPAWN && (to<=H1 || to>=A8)) {
+      int promo = (mp->m.flag > black) ? mp->m.flag - (BPAWN-WPAWN) : mp->m.flag;
+      san[len++] = '=';
+      san[len++] = " PNBRQK"[promo-1];
+    }
+  }
+  PushStatus();
+  MakeMove(mp);
+  if ((color==white) ? BlackKingInCheck() : WhiteKingInCheck())
+    san[len++] = (LegalMoves(mlst, NextSide(color))) ? '+' : '#';
+  RetractLastMove(); PopStatus();
+  san[len] = '\0';
+}
+
+void FormatScore(int score, int color, char *buf)
+{
+  /* score of color to move, printed from White's view in pawns or moves to mate */
+  if (score > MATE_CUTOFF)
+    sprintf(buf, "%sM%d", (color==white) ? "+" : "-", 1+(INFINITY_-score)/2);
+  else if (score < -MATE_CUTOFF)
+    sprintf(buf, "%sM%d", (color==white) ? "-" : "+", (INFINITY_+score)/2);
+  else
+    sprintf(buf, "%+.2f", 0.01*((color==white) ? score : -score));
+}
+
+struct ply_st {
+  char san[12], best[12];
+  int score, depth;     /* search of the position before the move */
+  int color;            /* side to move there */
+  int terminal;         /* position after the move: 1 mate, 2 stalemate */
+} PGNPlies[PGN_MAX_PLIES+1];
+
+void AnnotateGame(int index, char *task, int format)
+{
+  /* Replay the game and search the position before every move. The tables and
+     history stay warm from one move to the next, as they do in a real game. */
+  char tags[32][2][128], result[16]="*", token[64], out[BATCH_LINE], fen[128], s1[16], s2[16];
+  char *cp=task;
+  const char *error=NULL;
+  int ntags=0, color, nplies=0, i, len, FirstMove, FirstColor, depth;
+  MOVE amove, played, mlst[MAXMV];
+
+  while (*cp==' ' || *cp=='[') { /* tag pairs */
+    if (*cp=='[') {
+      char *end = strchr(cp, ']');
+      if (end==NULL)
+        break;
+      if (ntags < 32) /* further tags are dropped */
+        tags[ntags][1][0] = '\0';
+      if (ntags < 32 && sscanf(cp, "[%127s \"%127[^\"]", tags[ntags][0], tags[ntags][1]) >= 1) {
+        if (cp[strcspn(cp, "\"")+1]=='"')
+          tags[ntags][1][0] = '\0';
+        ntags++;
+      }
+      cp = end;
+    }
+    cp++;
+  }
+  StartingPosition();
+  color = white;
+  for (i=0; i<ntags; i++) {
+    if (!strcmp(tags[i][0], "FEN") && !ReadFEN(tags[i][1], &color))
+      error = "illegal FEN tag";
+    if (!strcmp(tags[i][0], "Result"))
+      strcpy(result, tags[i][1]);
+  }
+  FirstMove = StartMoveNumber;
+  FirstColor = color;
+  ClearHashTables();
+  ResetHistory();
+  GlobalPV.cmove = 0;
+  ngmax = PrevNgmax = -INFINITY_;
+  while (!error && *cp) {
+    int braces;
+    cp += strspn(cp, " .");
+    if (*cp=='{' || *cp=='(') { /* comments and variations are skipped */
+      char open=*cp, close=(*cp=='{') ? '}' : ')';
+      for (braces=0; *cp; cp++) {
+        if (*cp==open) braces++;
+        if (*cp==close && --braces==0) { cp++; break; }
+      }
+      continue;
+    }
+    if (sscanf(cp, "%63[^ {(]", token) < 1)
+      break;
+    cp += strlen(token);
+    if (token[0]=='$')
+      continue;
+    if (!strcmp(token, "1-0") || !strcmp(token, "0-1") || !strcmp(token, "1/2-1/2") || !strcmp(token, "*")) {
+      strcpy(result, token);
+      break;
+    }
+    len = strspn(token, "0123456789"); /* move number, possibly glued to the move */
+    if (token[len]=='.' || token[len]=='\0') {
+      len += strspn(token+len, ".");
+      if (token[len]=='\0')
+        continue;
+    } else {
+      len = 0;
+    }
+    if (!ParseSAN(token+len, &played, color)) {
+      error = "illegal move";
+      break;
+    }
+    if (nplies >= PGN_MAX_PLIES)
+      break;
+    amove.u = 0;
+    GetBestMove(&amove, color);
+    depth = CompletedDepth;
+    PGNPlies[nplies].score = ngmax;
+    PGNPlies[nplies].depth = depth;
+    PGNPlies[nplies].color = color;
+    MoveToSAN(&played, color, PGNPlies[nplies].san);
+    if (amove.u)
+      MoveToSAN(&amove, color, PGNPlies[nplies].best);
+    else
+      PGNPlies[nplies].best[0] = '\0';
+    if (format==BATCH_JSON) {
+      WriteFEN(fen, color);
+      if (depth > 0)
+        FormatScore(ngmax, color, s1);
+      else
+        s1[0] = '\0';
+      sprintf(out, "{\"game\":%d,\"ply\":%d,\"fen\":\"%s\",\"move\":\"%s\",\"best\":\"%s\",\"score\":%d,"
+              "\"eval\":\"%s\",\"depth\":%d,\"nodes\":%llu}\n", index, nplies+1, fen, PGNPlies[nplies].san,
+              PGNPlies[nplies].best, (color==white) ? ngmax : -ngmax, s1, depth, g_nodes);
+      BatchOutput(out);
+    }
+    UpdateSpecialConditions(&played);
+    PushStatus();
+    MakeMove(&played);
+    color = NextSide(color);
+    PGNPlies[nplies].terminal = 0;
+    if (LegalMoves(mlst, color)==0)
+      PGNPlies[nplies].terminal = ((color==white) ? WhiteKingInCheck() : BlackKingInCheck()) ? 1 : 2;
+    nplies++;
+  }
+  /* the position after the last move gives that move its evaluation */
+  PGNPlies[nplies].depth = 0;
+  if (nplies > 0 && !PGNPlies[nplies-1].terminal) {
+    amove.u = 0;
+    GetBestMove(&amove, color);
+    PGNPlies[nplies].score = ngmax;
+    PGNPlies[nplies].depth = CompletedDepth;
+    PGNPlies[nplies].color = color;
+  }
+  if (format==BATCH_JSON) {
+    len = sprintf(out, "{\"game\":%d,\"plies\":%d,\"result\":\"%s\"", index, nplies, result);
+    if (PGNPlies[nplies].depth > 0)
+      len += sprintf(out+len, ",\"score\":%d,\"depth\":%d", (color==white) ? ngmax : -ngmax, CompletedDepth);
+    sprintf(out+len, "%s%s%s}\n", (error) ? ",\"error\":\"" : "", (error) ? error : "", (error) ? "\"" : "");
+    BatchOutput(out);
+    return;
+  }
+  /* Annotated PGN: each move gets the evaluation of the position it leads to,
+     and the engine's choice where it differs from the move played */
+  for (i=0; i<ntags; i++) {
+    snprintf(out, sizeof(out), "[%.127s \"%.127s\"]\n", tags[i][0], tags[i][1]);
+    BatchOutput(out);
+  }
+  sprintf(out, "[Annotator \"NGplay\"]\n\n");
+  BatchOutput(out);
+  len = 0;
+  for (i=0; i<nplies; i++) {
+    char item[128], note[64];
+    int n, k=0, MoveNo = FirstMove + (i + (FirstColor==black)) / 2;
+    int WhiteToMove = ((i%2==0) == (FirstColor==white));
+    note[0] = '\0';
+    if (PGNPlies[i].terminal) {
+      strcpy(note, (PGNPlies[i].terminal==1) ? "mate" : "stalemate");
+    } else {
+      if (PGNPlies[i+1].depth > 0) { /* no search: book move or single reply */
+        FormatScore(PGNPlies[i+1].score, PGNPlies[i+1].color, s1);
+        k += sprintf(note+k, "%s/%d", s1, PGNPlies[i+1].depth);
+      }
+      if (PGNPlies[i].best[0] && strcmp(PGNPlies[i].san, PGNPlies[i].best)) {
+        k += sprintf(note+k, (k) ? " best %s" : "best %s", PGNPlies[i].best);
+        if (PGNPlies[i].depth > 0) {
+          FormatScore(PGNPlies[i].score, PGNPlies[i].color, s2);
+          k += sprintf(note+k, " %s/%d", s2, PGNPlies[i].depth);
+        }
+      }
+    }
+    n = sprintf(item, WhiteToMove ? "%d. %s" : "%d... %s", MoveNo, PGNPlies[i].san);
+    if (note[0])
+      n += sprintf(item+n, " {%s}", note);
+    if (len + n > 79) {
+      out[len++] = '\n';
+      out[len] = '\0';
+      BatchOutput(out);
+      len = 0;
+    }
+    len += sprintf(out+len, (len) ? " %s" : "%s", item);
+  }
+  if (error)
+    len += sprintf(out+len, (len) ? " {%s}" : "{%s}", error);
+  sprintf(out+len, (len) ? " %s\n\n" : "%s\n\n", result);
+  BatchOutput(out);
+}
+
+/* ----------------------- ENGINE MATCHES ---------------------------------------- */
+/* Two xboard engines play each other through pipes while this program keeps
+   the board, the clocks and the rules. Games run on the batch worker pool, each
+   worker with its own pair of engine processes, and go in pairs with the same
+   opening and colours reversed. The parent adds the results up and stops early
+   when the SPRT reaches a decision. */
+
+#define MATCH_HANG_MS     60000 /* longest wait for a move without a clock */
+#define MATCH_TIME_MARGIN 200   /* ms of pipe latency forgiven on the clock */
+#define MATCH_MAX_PLIES   (MAX_STACK - 32) /* adjudicated a draw there */
+
+struct match_st {
+  const char *cmd[2];       /* engine A and B */
+  int games, TimeMins, Incr, st;
+  unsigned long long nodes;
+  int sprt;
+  double elo0, elo1, alpha, beta;
+  FILE *pgn;
+  int wins, losses, draws;  /* from A's side */
+  long long moves[2], depths[2], ms[2];
+  unsigned long long searched[2];
+} Match = {{NULL, NULL}, 2, 1, 1, 0, 0ULL, 0, 0.0, 5.0, 0.05, 0.05, NULL};
+
+#ifndef _WIN32
+struct engine_st {
+  pid_t pid;
+  int in, out, setboard;    /* pipes to and from the engine */
+  char buf[BATCH_LINE];
+  int len;
+} MatchEngines[2];
+
+void EngineSend(struct engine_st *e, const char *text)
+{
+  if (write(e->in, text, strlen(text)) < 0)
+    return;
+}
+
+int EngineReadLine(struct engine_st *e, char *line, long long timeout)
+{
+  /* 1 with a line, 0 on timeout, -1 when the engine is gone */
+  long long deadline = GetMillisecs() + timeout;
+  for (;;) {
+    char *nl = (char *) memchr(e->buf, '\n', e->len);
+    fd_set fds;
+    struct timeval tv;
+    long long left;
+    int n;
+    if (nl != NULL) {
+      n = nl - e->buf;
+      memcpy(line, e->buf, n);
+      line[n] = '\0';
+      e->len -= n+1;
+      memmove(e->buf, nl+1, e->len);
+      return 1;
+    }
+    if (e->len >= BATCH_LINE-1) /* overlong line, dropped */
+      e->len = 0;
+    left = deadline - GetMillisecs();
+    if (left < 0)
+      return 0;
+    FD_ZERO(&fds);
+    FD_SET(e->out, &fds);
+    tv.tv_sec = left / 1000;
+    tv.tv_usec = (left % 1000) * 1000;
+    if (select(e->out+1, &fds, NULL, NULL, &tv) <= 0)
+      continue;
+    n = read(e->out, e->buf + e->len, BATCH_LINE-1 - e->len);
+    if (n <= 0)
+      return -1;
+    e->len += n;
+  }
+}
+
+void StopEngine(struct engine_st *e)
+{
+  if (e->pid > 0) {
+    kill(e->pid, SIGKILL);
+    waitpid(e->pid, NULL, 0);
+    close(e->in);
+    close(e->out);
+  }
+  e->pid = 0;
+}
+
+int StartEngine(struct engine_st *e, const char *cmd)
+{
+  int ToEngine[2], FromEngine[2], fd;
+  char line[BATCH_LINE];
+  if (pipe(ToEngine) != 0)
+    return 0;
+  if (pipe(FromEngine) != 0) {
+    close(ToEngine[0]); close(ToEngine[1]);
+    return 0;
+  }
+  e->pid = fork();
+  if (e->pid==0) {
+    dup2(ToEngine[0], 0);
+    dup2(FromEngine[1], 1);
+    fd = open("/dev/null", O_WRONLY);
+    if (fd >= 0)
+      dup2(fd, 2);
+    for (fd=3; fd<256; fd++)
+      close(fd);
+    execl("/bin/sh", "sh", "-c", cmd, (char *) NULL);
+    _exit(127);
+  }
+  close(ToEngine[0]);
+  close(FromEngine[1]);
+  e->in = ToEngine[1];
+  e->out = FromEngine[0];
+  e->len = 0;
+  e->setboard = 0;
+  if (e->pid < 0) {
+    close(e->in); close(e->out);
+    e->pid = 0;
+    return 0;
+  }
+  EngineSend(e, "xboard\nprotover 2\n");
+  while (EngineReadLine(e, line, 2000) > 0) { /* engines without protocol 2 stay silent */
+    if (!strncmp(line, "feature", 7)) {
+      if (strstr(line, "setboard=1"))
+        e->setboard = 1;
+      if (strstr(line, "done=1"))
+        break;
+    }
+  }
+  return 1;
+}
+
+int SyncEngine(struct engine_st *e, const char *cmd)
+{
+  /* Start the engine if needed and wait until it has read everything sent so far.
+     Engines without ping answer with an error message, which serves as well. */
+  static int PingNo=0;
+  char line[BATCH_LINE], pong[32];
+  int ret, tries;
+  for (tries=0; tries<2; tries++) {
+    if (e->pid <= 0 && !StartEngine(e, cmd))
+      return 0;
+    sprintf(pong, "pong %d", ++PingNo);
+    sprintf(line, "ping %d\n", PingNo);
+    EngineSend(e, line);
+    while ((ret = EngineReadLine(e, line, MATCH_HANG_MS)) > 0) {
+      if (!strcmp(line, pong) || (strstr(line, "rror") && strstr(line, "ping")))
+        return 1;
+    }
+    StopEngine(e); /* hung or crashed: restart it */
+  }
+  return 0;
+}
+
+int MatchGameOver(int color, char *reason)
+{
+  /* Result of the game for color to move: 1 win, -1 loss, 0 draw, 2 not over */
+  MOVE mlst[MAXMV];
+  int IsMaterialEnough;
+  if (LegalMoves(mlst, color)==0) {
+    if ((color==white) ? WhiteKingInCheck() : BlackKingInCheck()) {
+      strcpy(reason, "checkmate");
+      return -1;
+    }
+    strcpy(reason, "stalemate");
+    return 0;
+  }
+  StaticEval(&IsMaterialEnough);
+  if (IsMaterialEnough==0) {
+    strcpy(reason, "insufficient material");
+  } else if (HashRepetitions() >= 2) {
+    strcpy(reason, "3-fold repetition");
+  } else if (FiftyMoves >= 100) {
+    strcpy(reason, "fifty moves rule");
+  } else if (mv_stack_p >= MATCH_MAX_PLIES) {
+    strcpy(reason, "adjudicated, game too long");
+  } else {
+    return 2;
+  }
+  return 0;
+}
+
+void PlayMatchGame(int index, char *opening, int format)
+{
+  /* Engine A has White in odd rounds. Output: a "#stats" line for the parent, then the PGN */
+  static char movetext[BATCH_TASK];
+  char line[BATCH_LINE], out[BATCH_LINE], reason[64]="", san[12], mv[8], token[64], fen[128]="";
+  struct engine_st *eng[2]; /* by colour: [0] White, [1] Black */
+  int a_white = (index%2==1), color, i, k, result=2, going[2]={0,0}, len=0, ply=0, FirstColor;
+  long long clock[2], start, elapsed, moves[2]={0,0}, depths[2]={0,0}, ms[2]={0,0};
+  unsigned long long searched[2]={0,0};
+  char *cp;
+  MOVE m;
+
+  eng[0] = &MatchEngines[a_white ? 0 : 1];
+  eng[1] = &MatchEngines[a_white ? 1 : 0];
+  for (k=0; k<2; k++) {
+    if (!SyncEngine(&MatchEngines[k], Match.cmd[k])) {
+      sprintf(out, "#error engine %c does not respond\n", 'A'+k);
+      BatchOutput(out);
+      return;
+    }
+  }
+  /* the opening: a FEN or a list of moves from the initial position */
+  StartingPosition();
+  color = white;
+  if (strchr(opening, '/')) {
+    if (!ReadFEN(opening, &color)) {
+      sprintf(out, "#error illegal opening %.100s\n", opening);
+      BatchOutput(out);
+      return;
+    }
+    WriteFEN(fen, color);
+  }
+  for (k=0; k<2; k++) {
+    EngineSend(eng[k], "new\nforce\npost\n");
+    if (fen[0]) {
+      if (!eng[k]->setboard) {
+        sprintf(out, "#error engine %s cannot set up FEN openings\n", Match.cmd[(eng[k]==&MatchEngines[0]) ? 0 : 1]);
+        BatchOutput(out);
+        return;
+      }
+      sprintf(line, "setboard %s\n", fen);
+      EngineSend(eng[k], line);
+    }
+    sprintf(line, "level 0 %d %d\n", Match.TimeMins, Match.Incr); /* for engines without st */
+    EngineSend(eng[k], line);
+    if (Match.st) {
+      sprintf(line, "st %d\n", Match.st);
+      EngineSend(eng[k], line);
+    }
+    if (Match.nodes) {
+      sprintf(line, "nodes %llu\n", Match.nodes);
+      EngineSend(eng[k], line);
+    }
+  }
+  FirstColor = color;
+  movetext[0] = '\0';
+  cp = (fen[0]) ? opening + strlen(opening) : opening;
+  while (sscanf(cp, "%63s%n", token, &k) == 1) { /* opening moves are played in force mode */
+    cp += k;
+    if (!strcmp(token, "startpos") || token[strspn(token, "0123456789.")]=='\0')
+      continue;
+    if (!ParseSAN(token, &m, color)) {
+      sprintf(out, "#error illegal opening move %s\n", token);
+      BatchOutput(out);
+      return;
+    }
+    MoveToSAN(&m, color, san);
+    if (color==white || ply==0)
+      len += sprintf(movetext+len, "%s%d%s ", (len) ? " " : "",
+                     StartMoveNumber + (mv_stack_p + (FirstColor==black)) / 2, (color==white) ? "." : "...");
+    else
+      movetext[len++] = ' ';
+    len += sprintf(movetext+len, "%s", san);
+    sprintf(line, "%s\n", TranslateMoves(&m));
+    EngineSend(eng[0], line);
+    EngineSend(eng[1], line);
+    UpdateSpecialConditions(&m);
+    PushStatus();
+    MakeMove(&m);
+    color = NextSide(color);
+    ply++;
+  }
+  if (ply)
+    len += sprintf(movetext+len, " {book}");
+  clock[0] = clock[1] = Match.TimeMins * 60000LL;
+  mv[0] = '\0';
+  while ((result = MatchGameOver(color, reason)) == 2) {
+    struct engine_st *e = eng[(color==white) ? 0 : 1];
+    int c = (color==white) ? 0 : 1, depth=0, score=0, got=0;
+    unsigned long long nodes=0;
+    long long timeout;
+    if (!Match.st && !Match.nodes) /* the increment is credited when the move starts */
+      clock[c] += Match.Incr * 1000LL;
+    sprintf(line, "time %lld\notim %lld\n", clock[c]/10, clock[1-c]/10);
+    EngineSend(e, line);
+    if (mv[0]) { /* the opponent's move */
+      sprintf(line, "%s\n", mv);
+      EngineSend(e, line);
+    }
+    if (!going[c]) {
+      EngineSend(e, "go\n");
+      going[c] = 1;
+    }
+    timeout = (Match.st) ? Match.st*1000LL + MATCH_HANG_MS/4 : clock[c] + MATCH_TIME_MARGIN;
+    if (Match.nodes && timeout < MATCH_HANG_MS)
+      timeout = MATCH_HANG_MS;
+    start = GetMillisecs();
+    for (;;) {
+      long long left = timeout - (GetMillisecs() - start);
+      int ret = (left > 0) ? EngineReadLine(e, line, left) : 0;
+      if (ret <= 0) {
+        strcpy(reason, (ret < 0) ? "engine crashed" : (Match.st || Match.nodes) ? "engine hangs" : "time forfeit");
+        if (ret < 0)
+          StopEngine(e);
+        break;
+      }
+      if (strstr(line, "resign")) {
+        strcpy(reason, "resigns");
+        break;
+      } else if (line[0]>='0' && line[0]<='9') { /* thinking output: ply score time nodes pv */
+        int d, sc;
+        long long t;
+        unsigned long long n;
+        if (sscanf(line, "%d %d %lld %llu", &d, &sc, &t, &n) == 4) {
+          depth = d; score = sc; nodes = n;
+        }
+      } else if (sscanf(line, "move %7s", mv)==1) {
+        got = 1;
+        break;
+      }
+    }
+    elapsed = GetMillisecs() - start;
+    if (!got) {
+      result = -1;
+      if (reason[0]!='r') /* the engine did not resign: whatever it is doing must stop */
+        StopEngine(e);
+      break;
+    }
+    if (!Match.st && !Match.nodes) {
+      clock[c] -= elapsed;
+      if (clock[c] < -MATCH_TIME_MARGIN) {
+        strcpy(reason, "time forfeit");
+        result = -1;
+        break;
+      }
+    }
+    if (!ParseSAN(mv, &m, color)) {
+      sprintf(reason, "illegal move %s", mv);
+      result = -1;
+      break;
+    }
+    moves[c]++; depths[c] += depth; ms[c] += elapsed; searched[c] += nodes;
+    MoveToSAN(&m, color, san);
+    strcpy(mv, TranslateMoves(&m));
+    if (depth) {
+      FormatScore(score, white, token);
+      sprintf(token+strlen(token), "/%d %.1fs", depth, elapsed/1000.0);
+    } else {
+      sprintf(token, "%.1fs", elapsed/1000.0);
+    }
+    len += sprintf(movetext+len, "%s%d%s %s {%s}", (len) ? " " : "",
+                   StartMoveNumber + (mv_stack_p + (FirstColor==black)) / 2, (color==white) ? "." : "...", san, token);
+    UpdateSpecialConditions(&m);
+    PushStatus();
+    MakeMove(&m);
+    color = NextSide(color);
+    ply++;
+    if (len > BATCH_TASK - 256) {
+      strcpy(reason, "adjudicated, game too long");
+      result = 0;
+      break;
+    }
+  }
+  for (k=0; k<2; k++)
+    if (eng[k]->pid > 0)
+      EngineSend(eng[k], "force\n");
+  /* result for White */
+  if (result != 0)
+    result = (color==white) ? result : -result;
+  /* stats are kept for A then B */
+  i = a_white ? 0 : 1;
+  sprintf(out, "#stats %d %lld %lld %lld %llu %lld %lld %lld %llu\n", (a_white) ? result : -result,
+          moves[i], depths[i], ms[i], searched[i], moves[1-i], depths[1-i], ms[1-i], searched[1-i]);
+  BatchOutput(out);
+  sprintf(out, "[Event \"NGplay match\"]\n[Site \"local\"]\n[Round \"%d\"]\n[White \"%.200s\"]\n[Black \"%.200s\"]\n"
+          "[Result \"%s\"]\n", index, Match.cmd[a_white ? 0 : 1], Match.cmd[a_white ? 1 : 0],
+          (result > 0) ? "1-0" : (result < 0) ? "0-1" : "1/2-1/2");
+  BatchOutput(out);
+  if (fen[0]) {
+    sprintf(out, "[FEN \"%s\"]\n[SetUp \"1\"]\n", fen);
+    BatchOutput(out);
+  }
+  if (Match.st)
+    sprintf(out, "[TimeControl \"%d\"]\n[Termination \"%s\"]\n\n", Match.st, reason);
+  else
+    sprintf(out, "[TimeControl \"%d+%d\"]\n[Termination \"%s\"]\n\n", Match.TimeMins*60, Match.Incr, reason);
+  BatchOutput(out);
+  /* movetext wrapped at 80 columns */
+  sprintf(movetext+len, "%s{%s} %s", (len) ? " " : "", reason, (result > 0) ? "1-0" : (result < 0) ? "0-1" : "1/2-1/2");
+  for (cp=movetext; *cp; ) {
+    int n = strlen(cp);
+    if (n > 79) {
+      n = 79;
+      while (n > 0 && cp[n] != ' ')
+        n--;
+      if (n==0)
+        n = strcspn(cp, " ");
+    }
+    sprintf(out, "%.*s\n", n, cp);
+    BatchOutput(out);
+    cp += n;
+    cp += strspn(cp, " ");
+  }
+  BatchOutput("\n");
+}
+#endif
+
+int NextMatchGame(FILE *fp, char *task)
+{
+  /* Every opening is used for two games, with colours reversed */
+  static char opening[BATCH_LINE] = "startpos";
+  static int n=0, rewound=0;
+  if (n >= Match.games)
+    return 0;
+  if (n%2==0 && fp) {
+    while (!NextBatchLine(fp, opening)) {
+      if (rewound) { /* no usable line at all */
+        strcpy(opening, "startpos");
+        break;
+      }
+      rewind(fp);
+      rewound = 1;
+    }
+    rewound = 0;
+  }
+  strcpy(task, opening);
+  n++;
+  return 1;
+}
+
+void EloEstimate(double *elo, double *margin, double *var)
+{
+  /* Elo of A with a 95% confidence margin, from the per game score variance */
+  int n = Match.wins + Match.losses + Match.draws;
+  double s, lo, hi;
+  *elo = *margin = *var = 0.0;
+  if (n==0)
+    return;
+  s = (Match.wins + 0.5*Match.draws) / n;
+  *var = (Match.wins*(1-s)*(1-s) + Match.draws*(0.5-s)*(0.5-s) + Match.losses*s*s) / n;
+  if (s <= 0.0 || s >= 1.0) {
+    *elo = (s <= 0.0) ? -INFINITY_ : INFINITY_;
+    *margin = INFINITY_;
+    return;
+  }
+  *elo = -400.0 * log10(1.0/s - 1.0);
+  lo = s - 1.96*sqrt(*var/n);
+  hi = s + 1.96*sqrt(*var/n);
+  if (lo > 0.0 && hi < 1.0)
+    *margin = (-400.0*log10(1.0/hi - 1.0) + 400.0*log10(1.0/lo - 1.0)) / 2;
+  else
+    *margin = INFINITY_;
+}
+
+double SprtLLR(void)
+{
+  /* log likelihood ratio of elo1 against elo0, normal approximation of the trinomial */
+  int n = Match.wins + Match.losses + Match.draws;
+  double elo, margin, var, s, s0, s1;
+  EloEstimate(&elo, &margin, &var);
+  if (n==0 || var <= 0.0)
+    return 0.0;
+  s  = (Match.wins + 0.5*Match.draws) / n;
+  s0 = 1.0 / (1.0 + pow(10.0, -Match.elo0/400.0));
+  s1 = 1.0 / (1.0 + pow(10.0, -Match.elo1/400.0));
+  return (s1 - s0) * (2*s - s0 - s1) * n / (2*var);
+}
+
+void PrintMatchScore(void)
+{
+  int n = Match.wins + Match.losses + Match.draws;
+  double elo, margin, var;
+  EloEstimate(&elo, &margin, &var);
+  printf("Score of A vs B: %d - %d - %d  [%.3f] %d\n", Match.wins, Match.losses, Match.draws,
+         (n) ? (Match.wins + 0.5*Match.draws)/n : 0.0, n);
+  if (elo >= INFINITY_ || elo <= -INFINITY_) /* all wins or all losses so far */
+    printf("Elo difference: %s\n", (elo > 0) ? "+inf" : "-inf");
+  else if (margin >= INFINITY_)
+    printf("Elo difference: %.1f +/- inf\n", elo);
+  else
+    printf("Elo difference: %.1f +/- %.1f\n", elo, margin);
+  if (Match.sprt)
+    printf("SPRT: llr %.2f, lbound %.2f, ubound %.2f (elo0 %.1f, elo1 %.1f)\n", SprtLLR(),
+           log(Match.beta/(1-Match.alpha)), log((1-Match.beta)/Match.alpha), Match.elo0, Match.elo1);
+  fflush(stdout);
+}
+
+int MatchGameDone(const char *result)
+{
+  /* Book keeping in the parent. Returns 1 when the SPRT has decided */
+  int r, k, n;
+  long long moves[2], depths[2], ms[2];
+  unsigned long long searched[2];
+  const char *pgn = strchr(result, '\n');
+  if (!strncmp(result, "#error", 6)) {
+    printf("%.*s\n", (int)(pgn ? pgn-result-1 : strlen(result)-1), result+1);
+    return 0;
+  }
+  if (sscanf(result, "#stats %d %lld %lld %lld %llu %lld %lld %lld %llu", &r, &moves[0], &depths[0], &ms[0],
+             &searched[0], &moves[1], &depths[1], &ms[1], &searched[1]) != 9 || pgn==NULL)
+    return 0;
+  pgn++;
+  if (r > 0) Match.wins++;
+  else if (r < 0) Match.losses++;
+  else Match.draws++;
+  for (k=0; k<2; k++) {
+    Match.moves[k] += moves[k]; Match.depths[k] += depths[k];
+    Match.ms[k] += ms[k]; Match.searched[k] += searched[k];
+  }
+  if (Match.pgn) {
+    fputs(pgn, Match.pgn);
+    fflush(Match.pgn);
+  }
+  n = Match.wins + Match.losses + Match.draws;
+  {
+    const char *term = strstr(pgn, "[Termination \"");
+    const char *res = strstr(pgn, "[Result \"");
+    printf("Game %d/%d: %.*s {%.*s}\n", n, Match.games, (res) ? (int)strcspn(res+9, "\"") : 1, (res) ? res+9 : "?",
+           (term) ? (int)strcspn(term+14, "\"") : 0, (term) ? term+14 : "");
+  }
+  PrintMatchScore();
+  if (Match.sprt) {
+    double llr = SprtLLR();
+    if (llr >= log((1-Match.beta)/Match.alpha) || llr <= log(Match.beta/(1-Match.alpha)))
+      return 1;
+  }
+  return 0;
+}
+
+void RunMatch(const char *openings, int workers)
+{
+  FILE *fp = NULL;
+  int k;
+  double llr;
+  if (Match.cmd[0]==NULL || Match.cmd[1]==NULL) {
+    fprintf(stderr,"Two engines are needed\n");
+    return;
+  }
+  if (openings && (fp=fopen(openings,"r"))==NULL) {
+    fprintf(stderr,"Cannot open openings file %s\n", openings);
+    return;
+  }
+  printf("Match: A = %s, B = %s, %d games, ", Match.cmd[0], Match.cmd[1], Match.games);
+  if (Match.st)
+    printf("%d s/move", Match.st);
+  else
+    printf("%d min + %d s", Match.TimeMins, Match.Incr);
+  if (Match.nodes)
+    printf(", %llu nodes/move", Match.nodes);
+  printf("\n");
+  #ifdef _WIN32
+  printf("Engine matches need fork() and pipes.\n");
+  #else
+  signal(SIGPIPE, SIG_IGN);
+  if (workers > Match.games)
+    workers = Match.games;
+  RunBatch(fp, NextMatchGame, PlayMatchGame, MatchGameDone, workers, 0);
+  #endif
+  printf("\n===========================\n");
+  PrintMatchScore();
+  if (Match.sprt) {
+    llr = SprtLLR();
+    printf("SPRT: %s\n", (llr >= log((1-Match.beta)/Match.alpha)) ? "H1 accepted (elo1)" :
+           (llr <= log(Match.beta/(1-Match.alpha))) ? "H0 accepted (elo0)" : "no decision");
+  }
+  for (k=0; k<2; k++) { /* speed of the two engines: depth per move and nodes per second */
+    printf("Engine %c: %lld moves, average depth %.2f, %.0f nodes/s\n", 'A'+k, Match.moves[k],
+           (Match.moves[k]) ? (double)Match.depths[k]/Match.moves[k] : 0.0,
+           (Match.ms[k]) ? 1000.0*Match.searched[k]/Match.ms[k] : 0.0);
+  }
+  fflush(stdout);
+  if (fp)
+    fclose(fp);
+}
+
+/* ----------------------- ANALYSIS DAEMON --------------------------------------- */
+/* daemon <socket> [workers] keeps a pool of searching workers with their hash tables
+   ready and serves requests on a Unix domain socket, one line each:
+     go <id> [game <key>] [depth N] [nodes N] [movetime MS] [fen <FEN> | startpos] [moves ...]
+     stop <id>    status    quit    shutdown
+   Replies are "queued <id>", "info <id> depth D score S time T nodes N pv ...",
+   "bestmove <id> <move>" and "error <id> <reason>". Requests with the same game key go
+   to the same worker, which keeps its tables between them. */
+
+#define DAEMON_MAX_CLIENTS 32
+#define DAEMON_QUEUE       256
+#define DAEMON_LINE        8192
+
+#ifndef _WIN32
+struct daemon_req_st {
+  int client;               /* slot in DaemonClients[], -1 once the client is gone */
+  int worker;               /* -1 when any worker will do */
+  char id[32];
+  char *task;
+};
+
+struct daemon_client_st {
+  int fd;
+  char buf[DAEMON_LINE];
+  int len;
+} DaemonClients[DAEMON_MAX_CLIENTS];
+
+struct daemon_req_st DaemonQueue[DAEMON_QUEUE], DaemonRunning[BATCH_MAX_WORKERS];
+int DaemonQueued=0;
+volatile int DaemonExit=0;
+char DaemonGame[64]; /* game key of the worker's last request */
+
+void DaemonStopSignal(int sig)
+{
+  NGStop(Engine);
+}
+
+void DaemonExitSignal(int sig)
+{
+  DaemonExit = 1;
+}
+
+void DaemonInfo(const NG_INFO *info, void *user)
+{
+  char out[BATCH_LINE];
+  sprintf(out, "info depth %d score %d time %lld nodes %llu pv %.3900s\n",
+          info->depth, info->score, info->time, info->nodes, info->pv);
+  BatchOutput(out);
+}
+
+void DaemonJob(int index, char *task, int format)
+{
+  /* Worker side: the request without its "go <id>", answered by info lines and bestmove */
+  NG_LIMITS limits;
+  char word[64], *fen=NULL, *moves=NULL, *cp=task, game[64], out[BATCH_LINE];
+  int n, limited=0, ok;
+  __sync_fetch_and_and(&StopRequest, 0); /* a late stop for the previous request must not end this one */
+  memset(&limits, 0, sizeof(limits));
+  game[0] = '\0';
+  while (sscanf(cp, " %63s%n", word, &n) == 1) {
+    cp += n;
+    if (!strcmp(word, "game") && sscanf(cp, " %63s%n", game, &n) == 1) {
+      cp += n;
+    } else if (!strcmp(word, "depth") && sscanf(cp, " %d%n", &limits.depth, &n) == 1) {
+      cp += n; limited = 1;
+    } else if (!strcmp(word, "nodes") && sscanf(cp, " %llu%n", &limits.nodes, &n) == 1) {
+      cp += n; limited = 1;
+    } else if (!strcmp(word, "movetime") && sscanf(cp, " %lld%n", &limits.movetime, &n) == 1) {
+      cp += n; limited = 1;
+    } else if (!strcmp(word, "startpos")) {
+      fen = NULL;
+    } else if (!strcmp(word, "fen")) {
+      fen = cp;
+      if ((cp = strstr(cp, " moves ")) == NULL)
+        break;
+      *cp++ = '\0';
+    } else if (!strcmp(word, "moves")) {
+      moves = cp;
+      break;
+    } else {
+      sprintf(out, "error unknown word %.32s\n", word);
+      BatchOutput(out);
+      return;
+    }
+  }
+  if (!game[0] || strcmp(game, DaemonGame)) { /* the tables only help within a game */
+    NGClear(Engine);
+    strcpy(DaemonGame, game);
+  }
+  if (!NGSetPosition(Engine, fen, moves)) {
+    BatchOutput("error illegal position or move\n");
+    DaemonGame[0] = '\0';
+    return;
+  }
+  ok = NGSearch(Engine, (limited) ? &limits : NULL, DaemonInfo, NULL);
+  sprintf(out, "bestmove %s\n", (ok) ? NGResult(Engine)->bestmove : "(none)");
+  BatchOutput(out);
+}
+
+void DaemonSend(int client, const char *word, const char *id, const char *rest)
+{
+  char out[BATCH_LINE+64];
+  int len;
+  if (client < 0 || DaemonClients[client].fd < 0)
+    return;
+  len = sprintf(out, "%s %s%s%.*s\n", word, id, (*rest) ? " " : "", BATCH_LINE, rest);
+  if (write(DaemonClients[client].fd, out, len) != len) {
+    close(DaemonClients[client].fd); /* gone, its requests are dropped below */
+    DaemonClients[client].fd = -2;
+  }
+}
+
+unsigned int DaemonHash(const char *key)
+{
+  unsigned int h = 5381;
+  while (*key)
+    h = h*33 + (unsigned char)*key++;
+  return h;
+}
+
+void DaemonRequest(int client, char *line, int workers, pid_t *pids)
+{
+  char cmd[16], id[32], game[64], *cp;
+  int n, k;
+  line[strcspn(line, "\r")] = '\0';
+  if (sscanf(line, " %15s%n", cmd, &n) < 1)
+    return;
+  cp = line + n;
+  id[0] = '\0';
+  sscanf(cp, " %31s%n", id, &n);
+  if (!strcmp(cmd, "go")) {
+    if (!id[0]) {
+      DaemonSend(client, "error", "-", "go needs an id");
+      return;
+    }
+    if (DaemonQueued >= DAEMON_QUEUE) {
+      DaemonSend(client, "error", id, "queue full");
+      return;
+    }
+    cp += n;
+    k = -1;
+    for (line=cp; sscanf(line, " %63s%n", game, &n) == 1 && strcmp(game, "fen") && strcmp(game, "moves"); line += n) {
+      if (!strcmp(game, "game") && sscanf(line+n, " %63s", game) == 1) {
+        k = DaemonHash(game) % workers;
+        break;
+      }
+    }
+    DaemonQueue[DaemonQueued].client = client;
+    DaemonQueue[DaemonQueued].worker = k;
+    strcpy(DaemonQueue[DaemonQueued].id, id);
+    DaemonQueue[DaemonQueued].task = strdup(cp);
+    DaemonQueued++;
+    DaemonSend(client, "queued", id, "");
+  } else if (!strcmp(cmd, "stop")) {
+    for (k=0; k<DaemonQueued; k++) {
+      if (DaemonQueue[k].client==client && !strcmp(DaemonQueue[k].id, id)) {
+        DaemonSend(client, "error", id, "cancelled");
+        free(DaemonQueue[k].task);
+        memmove(&DaemonQueue[k], &DaemonQueue[k+1], (DaemonQueued-k-1)*sizeof(DaemonQueue[0]));
+        DaemonQueued--;
+        return;
+      }
+    }
+    for (k=0; k<workers; k++) {
+      if (DaemonRunning[k].task && DaemonRunning[k].client==client && !strcmp(DaemonRunning[k].id, id))
+        kill(pids[k], SIGUSR1);
+    }
+  } else if (!strcmp(cmd, "status")) {
+    char out[64];
+    int running=0;
+    for (k=0; k<workers; k++)
+      running += (DaemonRunning[k].task != NULL);
+    sprintf(out, "workers %d running %d queued %d", workers, running, DaemonQueued);
+    DaemonSend(client, "status", out, "");
+  } else if (!strcmp(cmd, "quit")) {
+    close(DaemonClients[client].fd);
+    DaemonClients[client].fd = -2;
+  } else if (!strcmp(cmd, "shutdown")) {
+    DaemonExit = 1;
+  } else {
+    DaemonSend(client, "error", "-", "unknown command");
+  }
+}
+
+void DaemonDropClient(int client, int workers, pid_t *pids)
+{
+  /* queued requests go, running ones are stopped and their output discarded */
+  int k, j=0;
+  for (k=0; k<DaemonQueued; k++) {
+    if (DaemonQueue[k].client==client)
+      free(DaemonQueue[k].task);
+    else
+      DaemonQueue[j++] = DaemonQueue[k];
+  }
+  DaemonQueued = j;
+  for (k=0; k<workers; k++) {
+    if (DaemonRunning[k].task && DaemonRunning[k].client==client) {
+      DaemonRunning[k].client = -1;
+      kill(pids[k], SIGUSR1);
+    }
+  }
+  DaemonClients[client].fd = -1;
+}
+
+void DaemonDispatch(int *TaskFd, int workers)
+{
+  /* Oldest request first. A request bound to a busy worker waits for it */
+  static int seq=0;
+  int i, k;
+  for (i=0; i<DaemonQueued; i++) {
+    k = DaemonQueue[i].worker;
+    if (k < 0) {
+      for (k=0; k<workers && DaemonRunning[k].task; k++)
+        ;
+      if (k==workers)
+        continue;
+    } else if (DaemonRunning[k].task) {
+      continue;
+    }
+    DaemonRunning[k] = DaemonQueue[i];
+    memmove(&DaemonQueue[i], &DaemonQueue[i+1], (DaemonQueued-i-1)*sizeof(DaemonQueue[0]));
+    DaemonQueued--;
+    i--;
+    SendBatchTask(TaskFd[k], ++seq, DaemonRunning[k].task);
+  }
+}
+
+void RunDaemon(const char *path, int workers)
+{
+  struct sockaddr_un addr;
+  struct sigaction sa;
+  int listener, TaskFd[BATCH_MAX_WORKERS], ResultPipe[2], i, k, len=0, maxfd;
+  pid_t pids[BATCH_MAX_WORKERS];
+  char results[BATCH_LINE+64];
+  fd_set fds;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr,"Socket path too long\n");
+    return;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path);
+  if ((listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+      bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 16) != 0) {
+    fprintf(stderr,"Cannot listen on %s\n", path);
+    return;
+  }
+  if (!max_nodes && !exact_time && max_depth==MAX_DEPTH)
+    SetExactTime(BATCH_SECS);
+  Xoutput = 0;
+  fflush(stdout);
+  if (pipe(ResultPipe) != 0) {
+    fprintf(stderr,"Cannot create pipe\n");
+    return;
+  }
+  for (k=0; k<workers; k++) {
+    int TaskPipe[2];
+    if (pipe(TaskPipe) != 0)
+      break;
+    if ((pids[k] = fork()) == 0) {
+      for (i=0; i<k; i++)
+        close(TaskFd[i]);
+      close(TaskPipe[1]);
+      close(ResultPipe[0]);
+      close(listener);
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_handler = DaemonStopSignal;
+      sa.sa_flags = SA_RESTART;
+      sigaction(SIGUSR1, &sa, NULL);
+      signal(SIGTERM, SIG_DFL);
+      BatchWorkerId = k;
+      BatchResultFd = ResultPipe[1];
+      NGClear(Engine); /* touch the tables now rather than on the first request */
+      BatchWorker(TaskPipe[0], DaemonJob, 0);
+      _exit(0);
+    }
+    close(TaskPipe[0]);
+    TaskFd[k] = TaskPipe[1];
+    DaemonRunning[k].task = NULL;
+  }
+  workers = k;
+  close(ResultPipe[1]);
+  for (i=0; i<DAEMON_MAX_CLIENTS; i++)
+    DaemonClients[i].fd = -1;
+  signal(SIGPIPE, SIG_IGN);
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = DaemonExitSignal; /* no SA_RESTART: select() returns and we clean up */
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  fprintf(stderr,"Listening on %s with %d workers\n", path, workers);
+  while (!DaemonExit && workers > 0) {
+    FD_ZERO(&fds);
+    FD_SET(listener, &fds);
+    FD_SET(ResultPipe[0], &fds);
+    maxfd = (listener > ResultPipe[0]) ? listener : ResultPipe[0];
+    for (i=0; i<DAEMON_MAX_CLIENTS; i++) {
+      if (DaemonClients[i].fd >= 0) {
+        FD_SET(DaemonClients[i].fd, &fds);
+        if (DaemonClients[i].fd > maxfd)
+          maxfd = DaemonClients[i].fd;
+      }
+    }
+    if (select(maxfd+1, &fds, NULL, NULL, NULL) < 0)
+      continue;
+    if (FD_ISSET(ResultPipe[0], &fds)) {
+      /* worker lines are "k text" while a request runs and a bare "k" when it is done */
+      int n = read(ResultPipe[0], results+len, sizeof(results)-1-len);
+      char *line=results, *eol, *text;
+      if (n <= 0)
+        break;
+      len += n;
+      results[len] = '\0';
+      while ((eol = strchr(line, '\n')) != NULL) {
+        *eol = '\0';
+        k = atoi(line);
+        text = line + strspn(line, "0123456789");
+        if (k >= 0 && k < workers && DaemonRunning[k].task) {
+          if (*text==' ') {
+            char word[16];
+            int w=0;
+            sscanf(text+1, "%15s%n", word, &w);
+            DaemonSend(DaemonRunning[k].client, word, DaemonRunning[k].id, text+1+w+(text[1+w]==' '));
+          } else {
+            free(DaemonRunning[k].task);
+            DaemonRunning[k].task = NULL;
+          }
+        }
+        line = eol+1;
+      }
+      len -= line - results;
+      memmove(results, line, len);
+    }
+    if (FD_ISSET(listener, &fds)) {
+      int fd = accept(listener, NULL, NULL);
+      for (i=0; i<DAEMON_MAX_CLIENTS && DaemonClients[i].fd >= 0; i++)
+        ;
+      if (fd >= 0 && i==DAEMON_MAX_CLIENTS) {
+        write(fd, "error - too many clients\n", 25);
+        close(fd);
+      } else if (fd >= 0) {
+        DaemonClients[i].fd = fd;
+        DaemonClients[i].len = 0;
+      }
+    }
+    for (i=0; i<DAEMON_MAX_CLIENTS; i++) {
+      struct daemon_client_st *c = &DaemonClients[i];
+      char *line, *eol;
+      int n;
+      if (c->fd < 0 || !FD_ISSET(c->fd, &fds))
+        continue;
+      if ((n = read(c->fd, c->buf+c->len, sizeof(c->buf)-1-c->len)) <= 0) {
+        close(c->fd);
+        c->fd = -2;
+      } else {
+        c->len += n;
+        c->buf[c->len] = '\0';
+        line = c->buf;
+        while (c->fd >= 0 && (eol = strchr(line, '\n')) != NULL) {
+          *eol = '\0';
+          DaemonRequest(i, line, workers, pids);
+          line = eol+1;
+        }
+        c->len -= line - c->buf;
+        memmove(c->buf, line, c->len);
+        if (c->len == (int)sizeof(c->buf)-1) { /* no line end in sight */
+          DaemonSend(i, "error", "-", "line too long");
+          c->len = 0;
+        }
+      }
+    }
+    for (i=0; i<DAEMON_MAX_CLIENTS; i++) {
+      if (DaemonClients[i].fd == -2)
+        DaemonDropClient(i, workers, pids);
+    }
+    DaemonDispatch(TaskFd, workers);
+  }
+  for (k=0; k<workers; k++) {
+    close(TaskFd[k]);
+    if (DaemonRunning[k].task)
+      kill(pids[k], SIGUSR1);
+  }
+  while (wait(NULL) > 0)
+    ;
+  for (i=0; i<DAEMON_MAX_CLIENTS; i++) {
+    if (DaemonClients[i].fd >= 0)
+      close(DaemonClients[i].fd);
+  }
+  close(listener);
+  unlink(path);
+}
+#endif
+
+void Printmenu()
+{
+  fprintf(stderr,"xboard - switch to XBoard mode\n");
+  fprintf(stderr,"play   - Play using Native console\n");
+  fprintf(stderr,"perft  - Performance test. (used also for Move Generation check) \n");
+  fprintf(stderr,"bench  - Search the benchmark positions to a fixed depth. \n");
+  fprintf(stderr,"setboard <FEN> - set up a position. fen - print the current position. \n");
+  fprintf(stderr,"epd <file> <secs> - run an EPD test suite (bm/am). \n");
+  fprintf(stderr,"help   - displays a list of commands.\n");
+  fprintf(stderr,"bye    - exit the program\n");
+}
+
+/* -------  Main Function for NGplay Chess Engine -------- */
+
+/* ----------------------- LIBRARY INTERFACE ------------------------------------ */
+/* The functions of NGplay.h. The console and xboard front ends below use them as
+   well. Compile with -DNGPLAY_LIBRARY to leave main() out. */
+
+int EngineReady=0;
+
+void InitEngine(void)
+{
+  if (EngineReady)
+    return;
+  Init_Pawn_Eval();
+  InitDirections();
+  MAX_TT  = 0x7fffff;
+  PMAX_TT = (MAX_TT+1)/2-1;
+  InitHash();
+  StartingPosition();
+  side = white;
+  #ifndef _WIN32
+  NofCores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  #endif
+  if (NofCores < 1)
+    NofCores = 1;
+  EngineReady = 1;
+}
+
+#define SHARED_TT_MAGIC 0x4e47545431ULL
+
+struct shared_tt_st {        /* head of the segment, the two tables follow */
+  volatile unsigned long long magic;
+  unsigned int max_tt;
+  char pad[52];
+};
+
+size_t SharedTTSize(unsigned int max_tt)
+{
+  return sizeof(struct shared_tt_st) + 2*(size_t)(max_tt+CLUSTER_SIZE)*sizeof(struct tt_st);
+}
+
+void SharedTablesPath(char *path, size_t len, const char *name)
+{
+  snprintf(path, len, (name[0]=='/') ? "%s" : "/%s", name);
+}
+
+int MapSharedTables(const char *name)
+{
+  /* The first process sizes the segment, later ones take MAX_TT from its head. The
+     segment (/dev/shm/<name> on Linux) outlives the processes, "-m<name> unshare"
+     removes it. One left half made by a creator that died is made anew */
+  #ifdef _WIN32
+  fprintf(stderr,"Shared hash tables need POSIX shared memory.\n");
+  return 0;
+  #else
+  struct shared_tt_st *head;
+  struct stat st;
+  int fd, tries, created, attempt, StatOk;
+  size_t size;
+  char path[256];
+  SharedTablesPath(path, sizeof(path), name);
+  for (attempt=0; attempt<2; attempt++) {
+    created = 1;
+    size = SharedTTSize(MAX_TT);
+    if ((fd = shm_open(path, O_RDWR|O_CREAT|O_EXCL, 0600)) >= 0) {
+      if (ftruncate(fd, size) != 0) {
+        close(fd);
+        shm_unlink(path);
+        return 0;
+      }
+    } else if ((fd = shm_open(path, O_RDWR, 0600)) >= 0) {
+      created = 0;
+      for (tries=0; (StatOk = (fstat(fd, &st)==0)) && st.st_size < (off_t)sizeof(*head) && tries<100; tries++)
+        usleep(10000);
+      if (!StatOk) {
+        close(fd);
+        return 0;
+      }
+      size = st.st_size;
+    } else {
+      return 0;
+    }
+    head = NULL;
+    if (size >= sizeof(*head)) {
+      head = (struct shared_tt_st *) mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+      if (head==MAP_FAILED) {
+        close(fd);
+        return 0;
+      }
+    }
+    close(fd);
+    if (created) {
+      head->max_tt = MAX_TT;
+      __sync_synchronize();
+      head->magic = SHARED_TT_MAGIC;
+      break;
+    }
+    for (tries=0; head && tries<100 && head->magic != SHARED_TT_MAGIC; tries++)
+      usleep(10000);
+    if (head && head->magic == SHARED_TT_MAGIC) {
+      if (SharedTTSize(head->max_tt) > size) {
+        munmap(head, size);
+        return 0;
+      }
+      MAX_TT = head->max_tt;
+      break;
+    }
+    if (head)
+      munmap(head, size);
+    fprintf(stderr,"Shared hash %s was left unfinished, making it anew\n", path);
+    shm_unlink(path);
+  }
+  if (attempt==2)
+    return 0;
+  SharedTT[0] = T_T = (struct tt_st *)(head+1);
+  SharedTT[1] = Opp_T_T = T_T + MAX_TT+CLUSTER_SIZE;
+  return 1;
+  #endif
+}
+
+int RemoveSharedTables(const char *name)
+{
+  #ifdef _WIN32
+  return 0;
+  #else
+  char path[256];
+  SharedTablesPath(path, sizeof(path), name);
+  if (shm_unlink(path) != 0) {
+    fprintf(stderr,"Cannot remove shared hash %s\n", path);
+    return 0;
+  }
+  return 1;
+  #endif
+}
+
+int AllocateTables(void)
+{
+  if (SharedHashName) {
+    if (!MapSharedTables(SharedHashName))
+      return 0;
+    P_T_T = (struct ptt_st *) calloc(PMAX_TT+1, sizeof(struct ptt_st));
+    return (P_T_T != NULL);
+  }
+  T_T = (struct tt_st *) calloc(MAX_TT+CLUSTER_SIZE, sizeof(struct tt_st));
+  Opp_T_T = (struct tt_st *) calloc(MAX_TT+CLUSTER_SIZE, sizeof(struct tt_st));
+  P_T_T = (struct ptt_st *) calloc(PMAX_TT+1, sizeof(struct ptt_st));
+  if (T_T==NULL || Opp_T_T==NULL || P_T_T==NULL) {
+    free(T_T); free(Opp_T_T); free(P_T_T);
+    T_T = Opp_T_T = NULL;
+    P_T_T = NULL;
+    return 0;
+  }
+  return 1;
+}
+
+NG_ENGINE *NGCreate(void)
+{
+  if (TheEngine.created)
+    return NULL;
+  InitEngine();
+  if (T_T==NULL && !AllocateTables())
+    return NULL;
+  memset(&TheEngine, 0, sizeof(TheEngine));
+  TheEngine.info.bestmove = TheEngine.bestmove;
+  TheEngine.info.pv = TheEngine.pv;
+  TheEngine.created = 1;
+  return &TheEngine;
+}
+
+void NGDestroy(NG_ENGINE *engine)
+{
+  if (engine==NULL || !engine->created)
+    return;
+  #ifndef _WIN32
+  if (SharedHashName) { /* the segment stays for the other processes */
+    munmap((struct shared_tt_st *)SharedTT[0] - 1, SharedTTSize(MAX_TT));
+    T_T = Opp_T_T = NULL;
+  }
+  #endif
+  free(T_T); free(Opp_T_T); free(P_T_T);
+  T_T = Opp_T_T = NULL;
+  P_T_T = NULL;
+  engine->created = 0;
+}
+
+struct game_st {            /* everything StartingPosition() and ReadFEN() reset */
+  struct saved_board_st pos;
+  struct mvst *moves;
+  struct cst *flags;
+  int mv_stack_p, cst_p, HalfMovesPlayed, FiftyMoves, LoneKingReachedEdge;
+  int StartMoveNumber, StartColor, NotStartingPosition, side;
+  MOVE PlayerMove;
+  char CurrentLine[2048];
+};
+
+int SaveGame(struct game_st *g)
+{
+  SaveBoard(&g->pos);
+  g->moves = (struct mvst *) malloc((mv_stack_p+1)*sizeof(struct mvst));
+  g->flags = (struct cst *) malloc((cst_p+1)*sizeof(struct cst));
+  if (g->moves==NULL || g->flags==NULL) {
+    free(g->moves); free(g->flags);
+    return 0;
+  }
+  memcpy(g->moves, move_stack, (mv_stack_p+1)*sizeof(struct mvst));
+  memcpy(g->flags, cstack, (cst_p+1)*sizeof(struct cst));
+  g->mv_stack_p = mv_stack_p;
+  g->cst_p = cst_p;
+  g->HalfMovesPlayed = HalfMovesPlayed;
+  g->FiftyMoves = FiftyMoves;
+  g->LoneKingReachedEdge = LoneKingReachedEdge;
+  g->StartMoveNumber = StartMoveNumber;
+  g->StartColor = StartColor;
+  g->NotStartingPosition = NotStartingPosition;
+  g->side = side;
+  g->PlayerMove = PlayerMove;
+  memcpy(g->CurrentLine, CurrentLine, sizeof(CurrentLine));
+  return 1;
+}
+
+void RestoreGame(struct game_st *g)
+{
+  RestoreBoard(&g->pos);
+  memcpy(move_stack, g->moves, (g->mv_stack_p+1)*sizeof(struct mvst));
+  memcpy(cstack, g->flags, (g->cst_p+1)*sizeof(struct cst));
+  mv_stack_p = g->mv_stack_p;
+  cst_p = g->cst_p;
+  HalfMovesPlayed = g->HalfMovesPlayed;
+  FiftyMoves = g->FiftyMoves;
+  LoneKingReachedEdge = g->LoneKingReachedEdge;
+  StartMoveNumber = g->StartMoveNumber;
+  StartColor = g->StartColor;
+  NotStartingPosition = g->NotStartingPosition;
+  side = g->side;
+  PlayerMove = g->PlayerMove;
+  memcpy(CurrentLine, g->CurrentLine, sizeof(CurrentLine));
+}
+
+void DropGame(struct game_st *g)
+{
+  free(g->moves);
+  free(g->flags);
+}
+
+int NGSetPosition(NG_ENGINE *engine, const char *fen, const char *moves)
+{
+  /* All or nothing: a bad FEN or move leaves the game as it was */
+  int color=white, n;
+  char token[16];
+  MOVE m;
+  struct game_st saved;
+  if (!SaveGame(&saved))
+    return 0;
+  if (fen==NULL || !strncmp(fen + strspn(fen, " "), "startpos", 8)) {
+    StartingPosition();
+  } else if (!ReadFEN(fen, &color)) {
+    RestoreGame(&saved);
+    DropGame(&saved);
+    return 0;
+  }
+  while (moves && sscanf(moves, " %15s%n", token, &n) == 1) {
+    moves += n;
+    if (mv_stack_p >= MAX_STACK - MAX_PLY - 16 || !ParseSAN(token, &m, color)) {
+      RestoreGame(&saved);
+      DropGame(&saved);
+      return 0;
+    }
+    UpdateSpecialConditions(&m);
+    PushStatus();
+    MakeMove(&m);
+    AddMoveToLine(m.m.from, m.m.to); /* keeps the book in step */
+    PlayerMove.u = m.u;
+    color = NextSide(color);
+  }
+  DropGame(&saved);
+  side = color;
+  return 1;
+}
+
+int NGSearch(NG_ENGINE *engine, const NG_LIMITS *limits, NG_INFO_CB callback, void *user)
+{
+  int ret, SavedDepth=max_depth, SavedExact=exact_time;
+  long long int SavedTime=max_time;
+  unsigned long long SavedNodes=max_nodes;
+  if (limits) {
+    SetMaxDepth(limits->depth);
+    max_nodes = limits->nodes;
+    max_time = (limits->movetime > 0) ? limits->movetime : 24LL*3600*1000;
+    exact_time = 1;
+  }
+  InfoCallback = callback;
+  InfoUser = user;
+  engine->best.u = 0;
+  GlobalPV.argmove[0].u = 0; /* the PV of an earlier search is no result of this one */
+  ret = GetBestMove(&engine->best, side);
+  if (CompletedDepth > 0 && engine->best.u == GlobalPV.argmove[0].u) {
+    FillEngineInfo(engine, CompletedDepth);
+  } else { /* book move, single reply or draw, no search behind it */
+    strcpy(engine->bestmove, (engine->best.u) ? TranslateMoves(&engine->best) : "");
+    strcpy(engine->pv, engine->bestmove);
+    engine->info.depth = 0;
+    engine->info.score = 0;
+    engine->info.nodes = g_nodes;
+    engine->info.time = GetMillisecs() - start_time;
+  }
+  InfoCallback = NULL;
+  __sync_fetch_and_and(&StopRequest, 0); /* a stop that came while we ran was meant for us */
+  if (limits) {
+    max_depth = SavedDepth;
+    max_time = SavedTime;
+    max_nodes = SavedNodes;
+    exact_time = SavedExact;
+  }
+  return ret && engine->best.u;
+}
+
+void NGStop(NG_ENGINE *engine)
+{
+  __sync_fetch_and_or(&StopRequest, 1);
+}
+
+const NG_INFO *NGResult(NG_ENGINE *engine)
+{
+  return &engine->info;
+}
+
+void NGClear(NG_ENGINE *engine)
+{
+  ClearHashTables();
+  ResetHistory();
+  GlobalPV.cmove = 0;
+  ngmax = PrevNgmax = -INFINITY_;
+}
+
+#ifndef NGPLAY_LIBRARY
+int main(int argc, char **argv)
+{
+  char s[256], book_s[256];
+  int BenchDepth=-1, EpdSecs=0, BatchWorkers=0, BatchFormat=BATCH_CSV, BatchGames=0;
+  char *EpdFile=NULL, *BatchFile=NULL, *MatchOpenings=NULL, *DaemonSocket=NULL;
+  int MatchMode=0, Unshare=0;
+  InitEngine();
+  strcpy(book_s,"NG3book.txt");
+  if (argc>1) {
+     int i;
+     for (i=1; i<argc; i++) {
+       if (argv[i][0]=='-' && argv[i][1]=='b') {
+         strcpy(book_s, &(argv[i][2]));
+       } 
+       else if (argv[i][0]=='-' && argv[i][1]=='p') {
+         ReadPosition(&(argv[i][2]));
+       }
+       else if (argv[i][0]=='-' && argv[i][1]=='d') {
+         SetMaxDepth(atoi(&(argv[i][2])));
+       }
+       else if (argv[i][0]=='-' && argv[i][1]=='n') {
+         max_nodes = strtoull(&(argv[i][2]), NULL, 10);
+       }
+       else if (argv[i][0]=='-' && argv[i][1]=='t') {
+         SetExactTime(atoi(&(argv[i][2])));
+       }
+       else if (argv[i][0]=='-' && argv[i][1]=='m') { /* hash tables shared with other processes */
+         SharedHashName = &(argv[i][2]);
+       }
+       else if (argv[i][0]=='-' && argv[i][1]=='s') { /* deterministic mode */
+         SetSeed(strtoull(&(argv[i][2]), NULL, 10));
+       }
+       else if (!strcmp(argv[i], "unshare")) { /* remove the -m segment, then exit */
+         Unshare = 1;
+       }
+       else if (!strcmp(argv[i], "bench")) { /* bench [depth], then exit */
+         BenchDepth = (i+1 < argc) ? atoi(argv[i+1]) : 0;
+       }
+       else if (!strcmp(argv[i], "epd") && i+1 < argc) { /* epd file [secs], then exit */
+         EpdFile = argv[i+1];
+         EpdSecs = (i+2 < argc) ? atoi(argv[i+2]) : 0;
+       }
+       else if ((!strcmp(argv[i], "batch") || !strcmp(argv[i], "pgn")) && i+1 < argc) {
+         /* batch|pgn file|- [workers] [csv|json|pgn], then exit */
+         BatchGames = !strcmp(argv[i], "pgn");
+         BatchFormat = (BatchGames) ? BATCH_PGN : BATCH_CSV;
+         BatchFile = argv[++i];
+         if (i+1 < argc && argv[i+1][0]>='0' && argv[i+1][0]<='9')
+           BatchWorkers = atoi(argv[++i]);
+         if (i+1 < argc && !strcmp(argv[i+1], "json")) {
+           BatchFormat = BATCH_JSON; i++;
+         } else if (i+1 < argc && (!strcmp(argv[i+1], "csv") || !strcmp(argv[i+1], "pgn"))) {
+           i++;
+         }
+       }
+       else if (!strcmp(argv[i], "daemon") && i+1 < argc) { /* daemon socket [workers], until shutdown */
+         DaemonSocket = argv[++i];
+         if (i+1 < argc && argv[i+1][0]>='0' && argv[i+1][0]<='9')
+           BatchWorkers = atoi(argv[++i]);
+       }
+       else if (!strcmp(argv[i], "match") && i+2 < argc) {
+         /* match engineA engineB [games N] [concurrency N] [tc MIN+INC] [st SECS] [nodes N]
+                  [openings FILE] [pgnout FILE] [sprt ELO0 ELO1 [ALPHA BETA]], then exit */
+         MatchMode = 1;
+         Match.cmd[0] = argv[++i];
+         Match.cmd[1] = argv[++i];
+         while (i+2 < argc) {
+           if (!strcmp(argv[i+1], "games")) {
+             Match.games = atoi(argv[i+2]);
+           } else if (!strcmp(argv[i+1], "concurrency")) {
+             BatchWorkers = atoi(argv[i+2]);
+           } else if (!strcmp(argv[i+1], "tc")) {
+             Match.Incr = 0;
+             sscanf(argv[i+2], "%d+%d", &Match.TimeMins, &Match.Incr);
+           } else if (!strcmp(argv[i+1], "st")) {
+             Match.st = atoi(argv[i+2]);
+           } else if (!strcmp(argv[i+1], "nodes")) {
+             Match.nodes = strtoull(argv[i+2], NULL, 10);
+           } else if (!strcmp(argv[i+1], "openings")) {
+             MatchOpenings = argv[i+2];
+           } else if (!strcmp(argv[i+1], "pgnout")) {
+             if ((Match.pgn = fopen(argv[i+2], "a")) == NULL)
+               fprintf(stderr,"Cannot open %s\n", argv[i+2]);
+           } else if (!strcmp(argv[i+1], "sprt") && i+3 < argc) {
+             Match.sprt = 1;
+             Match.elo0 = atof(argv[i+2]);
+             Match.elo1 = atof(argv[++i+2]);
+             if (i+4 < argc && argv[i+3][0]>='0' && argv[i+3][0]<='9') {
+               Match.alpha = atof(argv[i+3]);
+               Match.beta  = atof(argv[i+4]);
+               i += 2;
+             }
+           } else {
+             break;
+           }
+           i += 2;
+         }
+       }
+       else if (argv[i][0]=='-' && argv[i][1]=='h') {
+       }
+     }
+  } 
+  if (SharedHashName && Deterministic) { /* reproducible only from empty tables of its own */
+    fprintf(stderr,"-s cannot be used with -m\n");
+    exit(1);
+  }
+  if (Unshare) { /* e.g. after a crash, the segment is not removed with the last process */
+    if (!SharedHashName) {
+      fprintf(stderr,"unshare needs -m<shared hash name>\n");
+      exit(1);
+    }
+    exit(RemoveSharedTables(SharedHashName) ? 0 : 1);
+  }
+  if (BatchFile || DaemonSocket) {
+    /* results own stdout. Workers share the usual table memory between them */
+    int slices=1;
+    if (BatchWorkers <= 0)
+      BatchWorkers = NofCores;
+    if (BatchWorkers > BATCH_MAX_WORKERS)
+      BatchWorkers = BATCH_MAX_WORKERS;
+    while (slices < BatchWorkers && !SharedHashName) {
+      MAX_TT = (MAX_TT+1)/2-1;
+      slices *= 2;
+    }
+    PMAX_TT = (MAX_TT+1)/2-1;
+  } else {
+    printf("\n");
+    printf("\n--  %s Chess Engine  --\n", argv[0]);
+    printf("Optional Run Time Usage: %s -p<positionFile> -b<BookFile> -d<depth> -n<nodes> -t<secs/move> -s<seed> -m<shared hash name> [unshare] [bench [depth]] [epd <file> [secs]] [batch <file|-> [workers] [csv|json]] [pgn <file|-> [workers] [pgn|json]] [match <engineA> <engineB> [options]] [daemon <socket> [workers]] \n", argv[0]);
+  }
+  Engine = NGCreate();
+  if (Engine==NULL) {
+    printf("\nUnable to allocate Hash Tables. Exiting.\n");
+    exit(1);
+  }
+  #ifdef DBGHASH
+  printf("\n%u MBytes allocated for Hash Tables. Hash location size=%d bytes.\n\n",
+         (unsigned int)(2*(MAX_TT+CLUSTER_SIZE)*sizeof(struct tt_st)/MByte), sizeof(struct tt_st));
+  printf("\n%u MBytes allocated for Pawn Hash Tables. Hash location size=%d bytes.\n\n",
+         (unsigned int)((PMAX_TT+1)*sizeof(struct ptt_st)/MByte), sizeof(struct ptt_st));
+  #else
+  if (!BatchFile && !DaemonSocket)
+    printf("\nMemory allocated for Hash Tables.\n\n");
+  #endif
+  if (DaemonSocket) {
+    #ifdef _WIN32
+    fprintf(stderr,"The daemon needs fork() and Unix domain sockets.\n");
+    #else
+    RunDaemon(DaemonSocket, BatchWorkers);
+    #endif
+    return 0;
+  }
+  if (MatchMode) {
+    RunMatch(MatchOpenings, (BatchWorkers > 0) ? BatchWorkers : NofCores);
+    return 0;
+  }
+  if (BatchFile) {
+    FILE *fp = (!strcmp(BatchFile, "-")) ? stdin : fopen(BatchFile, "r");
+    if (fp==NULL) {
+      fprintf(stderr,"Cannot open %s\n", BatchFile);
+      return 1;
+    }
+    if (BatchFormat==BATCH_CSV)
+      printf("index,fen,bestmove,score,depth,nodes,time,pv\n");
+    if (BatchGames)
+      RunBatch(fp, NextPGNGame, AnnotateGame, NULL, BatchWorkers, BatchFormat);
+    else
+      RunBatch(fp, NextBatchLine, AnalyseFEN, NULL, BatchWorkers, BatchFormat);
+    return 0;
+  }
+  if (BenchDepth >= 0) {
+    Bench(BenchDepth);
+    return 0;
+  }
+  if (EpdFile) {
+    RunEPD(EpdFile, EpdSecs);
+    return 0;
+  }
+  book_file = fopen(book_s, "r");
+   if (!book_file)
+     fprintf(stderr,"Opening book missing.\n");
+  printf("Commands available:\n\n");
+  Printmenu();
+  printf("\n");
+  for (;;) {
+    /* get user input */
+    fprintf(stderr,"> ");
+    if (scanf("%s", s) == EOF)
+      return 0;
+    if (!strcmp(s, "bye")) {
+      printf("Have a nice day!\n");
+      break;
+    }
+    if (!strcmp(s, "xboard")) {
+      Xoutput = _XBOARD_OUTPUT;
+      xboard();
+      break;
+    }
+    if (!strcmp(s, "play")) {
+      Xoutput = _NORMAL_OUTPUT;
+      ShowBoard();
+      do {
+        fprintf(stderr,"\nGive Computer Side (White = 1, Black = 2, None = 3) : ");
+        scanf("%d",&ComputerSide);
+      } while ((ComputerSide!=1) && (ComputerSide!=2) && (ComputerSide!=3));
+      if (ComputerSide==2) ComputerSide=black;
+      if (ComputerSide!=3) {
         fprintf(stderr,"Give Computer Time (seconds per move) : ");
         scanf("%lld", &max_time);
         max_time *= 1000;
@@ -7747,12 +11172,39 @@ int main(int argc, char **argv)
         fprintf(stderr,"Use Evasions : (yes = 1, no = 0) : ");
         scanf("%d",&Use_Evasions);
       } while ((Use_Evasions!=1) && (Use_Evasions!=0));
+      if (SharedHashName) /* node counts are no search results for the other processes */
+        Use_hash = 0;
       start_time = GetMillisecs();
-      Presult = Perft(start_depth, SideToMove, 1, Use_hash, Use_Evasions);
+      Presult = Perft(start_depth, SideToMove, 1, Use_hash, Use_Evasions, MoveArena);
       tn = SECONDS_PASSED;
       printf("\nPerft result = %llu nodes. Time used=%lf secs (%.0lf nodes/sec)", Presult, tn, floor(0.5+((double)Presult)/tn));
       break;
     }
+    if (!strcmp(s, "bench")) {
+      Bench(BENCH_DEPTH);
+      continue;
+    }
+    if (!strcmp(s, "setboard")) {
+      char fen[256];
+      if (fgets(fen, 256, stdin) && NGSetPosition(Engine, fen, NULL)) {
+        ShowBoard();
+      } else {
+        fprintf(stderr,"Illegal position.\n");
+      }
+      continue;
+    }
+    if (!strcmp(s, "epd")) {
+      char fname[256];
+      int secs=0;
+      if (scanf("%255s %d", fname, &secs) >= 1)
+        RunEPD(fname, secs);
+      continue;
+    }
+    if (!strcmp(s, "fen")) {
+      char fen[128];
+      printf("%s\n", WriteFEN(fen, side));
+      continue;
+    }
     if (!strcmp(s, "help")) {
       Printmenu();
       continue;
@@ -7762,3 +11214,4 @@ int main(int argc, char **argv)
     fclose(book_file);
   return 0;
 }
+#endif /* NGPLAY_LIBRARY */